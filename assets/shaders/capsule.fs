@@ -0,0 +1,20 @@
+#version 330
+
+// Input vertex attributes (from vertex shader)
+in vec2 fragLocal;
+flat in float fragHalfLength;
+flat in float fragRadius;
+in vec4 fragColor;
+
+// Output fragment color
+out vec4 finalColor;
+
+
+void main() {
+    float distance = length(vec2(max(abs(fragLocal.x) - fragHalfLength, 0.0), fragLocal.y));
+    float smoothing = fwidth(distance);
+    float coverage = 1.0 - smoothstep(fragRadius - smoothing, fragRadius, distance);
+    if (coverage <= 0.0) discard;
+
+    finalColor = vec4(fragColor.rgb, fragColor.a * coverage);
+}
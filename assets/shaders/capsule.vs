@@ -0,0 +1,35 @@
+#version 330
+
+// Input vertex attributes
+in vec2 vertexPosition;     // corner of the unit quad
+in vec4 instanceSegment;    // center, half of the segment
+in float instanceRadius;
+in vec4 vertexColor;        // per instance
+
+// Input uniform values
+uniform mat4 mvp;
+
+// Output vertex attributes (to fragment shader)
+out vec2 fragLocal;         // along and across the segment, in world units
+flat out float fragHalfLength;
+flat out float fragRadius;
+out vec4 fragColor;
+
+
+void main() {
+    vec2 axis = instanceSegment.zw;
+    float halfLength = length(axis);
+    vec2 direction = halfLength > 0.0 ? axis / halfLength : vec2(1.0, 0.0);
+    vec2 normal = vec2(-direction.y, direction.x);
+
+    // Grow the quad by a pixel or so, so the antialiased edge isn't clipped.
+    float margin = instanceRadius + 1.0;
+    vec2 local = vertexPosition * vec2(halfLength + margin, margin);
+    vec2 position = instanceSegment.xy + direction * local.x + normal * local.y;
+
+    fragLocal = local;
+    fragHalfLength = halfLength;
+    fragRadius = instanceRadius;
+    fragColor = vertexColor;
+    gl_Position = mvp * vec4(position, 0.0, 1.0);
+}
@@ -1,5 +1,7 @@
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -9,6 +11,7 @@ typedef struct {
   size_t elementSize;
   size_t used;
   size_t size;
+  bool isBorrowed; // array points at memory it doesn't own (e.g. a mapped file)
 } Array;
 
 
@@ -21,6 +24,10 @@ void* recalloc(void* source, size_t oldNumElement, size_t numElement, size_t siz
 
 Array aCreate(size_t initialCount, size_t elementSize);
 
+Array aBorrow(void* memory, size_t count, size_t elementSize);
+
+void aReserve(Array *a, size_t count);
+
 size_t aAppend(Array *a, void* element);
 
 void aFree(Array *a);
@@ -33,17 +40,48 @@ Array aCreate(size_t initialCount, size_t elementSize)
   a.elementSize = elementSize;
   a.used = 0;
   a.size = initialCount;
+  a.isBorrowed = false;
   return a;
 }
 
+// Wrap memory owned by someone else. It's used in place until the array has
+// to grow, at which point the contents are copied into owned memory.
+Array aBorrow(void* memory, size_t count, size_t elementSize) 
+{
+  Array a;
+  a.array = memory;
+  a.elementSize = elementSize;
+  a.used = count;
+  a.size = count;
+  a.isBorrowed = true;
+  return a;
+}
 
-size_t aAppend(Array *a, void* element) 
+// Make room for at least count elements.
+void aReserve(Array *a, size_t count) 
 {
-  if (a->used == a->size) {
-    size_t oldSize = a->size;
+  if (count <= a->size) return;
+
+  size_t oldSize = a->size;
+  if (a->size == 0) a->size = 1;
+  while (count > a->size) {
     a->size *= 2;
+  }
+
+  if (a->isBorrowed) {
+    void* newAddress = calloc(a->size, a->elementSize);
+    memcpy(newAddress, a->array, a->used * a->elementSize);
+    a->array = newAddress;
+    a->isBorrowed = false;
+  } else {
     a->array = recalloc(a->array, oldSize, a->size, a->elementSize);
   }
+}
+
+
+size_t aAppend(Array *a, void* element) 
+{
+  aReserve(a, a->used + 1);
   memcpy(a->array + a->used * a->elementSize, element, a->elementSize);
   a->used++;
 
@@ -54,13 +92,7 @@ size_t aAppendArray(Array *a, Array *other)
 {
   assert(a->elementSize == other->elementSize);
 
-  if (a->used + other->used > a->size) {
-    size_t oldSize = a->size;
-    while (a->used + other->used > a->size) {
-      a->size *= 2;
-    }
-    a->array = recalloc(a->array, oldSize, a->size, a->elementSize);
-  }
+  aReserve(a, a->used + other->used);
 
   memcpy(a->array + a->used * a->elementSize, other->array, other->used * a->elementSize);
 
@@ -69,17 +101,19 @@ size_t aAppendArray(Array *a, Array *other)
   return a->used;
 }
 
-size_t aAppendStaticArray(Array *a, void* other, size_t otherCount) 
+// Make a hold the same elements as other, reusing a's memory when it fits.
+void aCopy(Array *a, Array *other) 
 {
-  if (a->used + otherCount > a->size) {
-    size_t oldSize = a->size;
-    while (a->used + otherCount > a->size) {
-      a->size *= 2;
-    }
-    a->array = recalloc(a->array, oldSize, a->size, a->elementSize);
-  }
+  assert(a->elementSize == other->elementSize);
+
+  aReserve(a, other->used);
+  memcpy(a->array, other->array, other->used * a->elementSize);
+  a->used = other->used;
+}
 
-  
+size_t aAppendStaticArray(Array *a, void* other, size_t otherCount) 
+{
+  aReserve(a, a->used + otherCount);
 
   memcpy(a->array + a->used * a->elementSize, other, otherCount * a->elementSize);
 
@@ -91,7 +125,8 @@ size_t aAppendStaticArray(Array *a, void* other, size_t otherCount)
 
 void aFree(Array *a) 
 {
-  free(a->array);
+  if (!a->isBorrowed)
+    free(a->array);
   a->array = NULL;
   a->used = a->size = 0;
 }
@@ -0,0 +1,97 @@
+// Platform file mapping. Kept out of main.c since windows.h clashes with raylib.h.
+
+#include "file_map.h"
+
+#include <string.h>
+
+#if defined(_WIN32)
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+bool fileMapOpen(FileMap* map, const char* path) {
+    memset(map, 0, sizeof(FileMap));
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (data == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    map->data = data;
+    map->size = (size_t) size.QuadPart;
+    map->_file = file;
+    map->_mapping = mapping;
+    return true;
+}
+
+void fileMapClose(FileMap* map) {
+    if (map->data == NULL) {
+        return;
+    }
+    UnmapViewOfFile(map->data);
+    CloseHandle((HANDLE) map->_mapping);
+    CloseHandle((HANDLE) map->_file);
+    memset(map, 0, sizeof(FileMap));
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool fileMapOpen(FileMap* map, const char* path) {
+    memset(map, 0, sizeof(FileMap));
+
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0) {
+        close(file);
+        return false;
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    void* data = mmap(NULL, (size_t) info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    map->data = data;
+    map->size = (size_t) info.st_size;
+    return true;
+}
+
+void fileMapClose(FileMap* map) {
+    if (map->data == NULL) {
+        return;
+    }
+    munmap(map->data, map->size);
+    memset(map, 0, sizeof(FileMap));
+}
+
+#endif
@@ -0,0 +1,28 @@
+// Private, copy-on-write view of a whole file mapped into memory. The view
+// can be written, but the file itself is never changed.
+
+#ifndef _FILE_MAP_H
+#define _FILE_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Mapped file: open with fileMapOpen, release with fileMapClose.
+typedef struct {
+    void* data;   // start of the file contents
+    size_t size;  // file size in bytes
+
+    // Don't use these fields directly.
+    void* _file;
+    void* _mapping;
+} FileMap;
+
+// Map the file at path. Pages are copy-on-write: writes through data are
+// private to this process and never reach the file. Return false if the
+// file can't be opened or is empty.
+bool fileMapOpen(FileMap* map, const char* path);
+
+// Unmap the file. Pointers into data are invalid afterwards.
+void fileMapClose(FileMap* map);
+
+#endif // _FILE_MAP_H
@@ -0,0 +1,160 @@
+// CPU side geometry for lots of small round shapes, drawn as instanced quads.
+//
+// Every shape is a capsule: the points within radius of a segment. A circle is
+// a capsule with a zero length segment, a thick line is one with a long one.
+// The batch is a flat array of instances, ready to be uploaded as a vertex
+// buffer with one attribute divisor per instance; the shader expands each one
+// into a quad and cuts the capsule out of it.
+//
+// Nothing here talks to the GPU, so batches can be built and checked headless.
+
+#ifndef _GEOMETRY_BATCH_H
+#define _GEOMETRY_BATCH_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef struct GeometryInstance {
+    float x, y;          // center of the segment
+    float axisX, axisY;  // half of the segment, zero for circles
+    float radius;
+    uint32_t color;      // RGBA bytes
+} GeometryInstance;
+
+typedef struct GeometryBatch {
+    GeometryInstance* instances;
+    size_t count;
+    size_t capacity;
+} GeometryBatch;
+
+// count circles of the same radius and color, their centers interpolated
+// from previousPositions to positions like getEntityRenderPosition.
+typedef struct GeometryCircles {
+    const float* positions;          // x, y
+    const float* previousPositions;  // x, y
+    size_t stride;                   // bytes from one circle to the next, for both
+    size_t count;
+    float alpha;
+    float radius;
+    uint32_t color;
+} GeometryCircles;
+
+
+static inline void geometryBatchInit(GeometryBatch* batch, size_t capacity) {
+    batch->instances = malloc(capacity * sizeof(GeometryInstance));
+    batch->count = 0;
+    batch->capacity = capacity;
+}
+
+static inline void geometryBatchFree(GeometryBatch* batch) {
+    free(batch->instances);
+    batch->instances = NULL;
+    batch->count = 0;
+    batch->capacity = 0;
+}
+
+static inline void geometryBatchClear(GeometryBatch* batch) {
+    batch->count = 0;
+}
+
+// Make room for count more instances.
+static inline void geometryBatchReserve(GeometryBatch* batch, size_t count) {
+    if (batch->count + count <= batch->capacity) return;
+    size_t capacity = batch->capacity ? batch->capacity : 64;
+    while (capacity < batch->count + count) capacity *= 2;
+    batch->instances = realloc(batch->instances, capacity * sizeof(GeometryInstance));
+    assert(batch->instances);
+    batch->capacity = capacity;
+}
+
+static inline void geometryBatchAddCapsule(GeometryBatch* batch, float startX, float startY, float endX, float endY, float radius, uint32_t color) {
+    if (radius <= 0) return;
+    geometryBatchReserve(batch, 1);
+    batch->instances[batch->count++] = (GeometryInstance){
+        (startX + endX) * 0.5f, (startY + endY) * 0.5f,
+        (endX - startX) * 0.5f, (endY - startY) * 0.5f,
+        radius, color
+    };
+}
+
+static inline void geometryBatchAddCircle(GeometryBatch* batch, float x, float y, float radius, uint32_t color) {
+    if (radius <= 0) return;
+    geometryBatchReserve(batch, 1);
+    batch->instances[batch->count++] = (GeometryInstance){x, y, 0, 0, radius, color};
+}
+
+// Reference version of geometryBatchAddCircles, one circle at a time.
+static inline void geometryBatchAddCirclesScalar(GeometryBatch* batch, const GeometryCircles* circles) {
+    if (circles->radius <= 0) return;
+    geometryBatchReserve(batch, circles->count);
+    GeometryInstance* instance = &batch->instances[batch->count];
+    const char* position = (const char*) circles->positions;
+    const char* previousPosition = (const char*) circles->previousPositions;
+
+    for (size_t i = 0; i < circles->count; i++) {
+        const float* current = (const float*) (position + i * circles->stride);
+        const float* previous = (const float*) (previousPosition + i * circles->stride);
+        instance[i] = (GeometryInstance){
+            previous[0] + circles->alpha * (current[0] - previous[0]),
+            previous[1] + circles->alpha * (current[1] - previous[1]),
+            0, 0, circles->radius, circles->color
+        };
+    }
+    batch->count += circles->count;
+}
+
+// Same output as geometryBatchAddCirclesScalar, two circles per step with SSE2:
+// both centers are interpolated in one register, then the pair is written as
+// three 16 byte stores.
+static inline void geometryBatchAddCircles(GeometryBatch* batch, const GeometryCircles* circles) {
+#ifdef __SSE2__
+    if (circles->radius <= 0) return;
+    geometryBatchReserve(batch, circles->count);
+    float* out = (float*) &batch->instances[batch->count];
+    const char* position = (const char*) circles->positions;
+    const char* previousPosition = (const char*) circles->previousPositions;
+    size_t stride = circles->stride;
+
+    float colorBits;
+    memcpy(&colorBits, &circles->color, sizeof(colorBits));
+    __m128 radiusColor = _mm_setr_ps(circles->radius, colorBits, circles->radius, colorBits);
+    __m128 alpha = _mm_set1_ps(circles->alpha);
+    __m128 zero = _mm_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 2 <= circles->count; i += 2) {
+        __m128 current = _mm_loadl_pi(zero, (const __m64*) (position + i * stride));
+        current = _mm_loadh_pi(current, (const __m64*) (position + (i + 1) * stride));
+        __m128 previous = _mm_loadl_pi(zero, (const __m64*) (previousPosition + i * stride));
+        previous = _mm_loadh_pi(previous, (const __m64*) (previousPosition + (i + 1) * stride));
+
+        // x0 y0 x1 y1
+        __m128 center = _mm_add_ps(previous, _mm_mul_ps(alpha, _mm_sub_ps(current, previous)));
+
+        _mm_storeu_ps(out + 0, _mm_movelh_ps(center, zero));                                // x0 y0 0 0
+        _mm_storeu_ps(out + 4, _mm_movelh_ps(radiusColor, _mm_movehl_ps(center, center)));  // r c x1 y1
+        _mm_storeu_ps(out + 8, _mm_movelh_ps(zero, radiusColor));                           // 0 0 r c
+        out += 12;
+    }
+    batch->count += i;
+
+    if (i < circles->count) {
+        GeometryCircles rest = *circles;
+        rest.positions = (const float*) (position + i * stride);
+        rest.previousPositions = (const float*) (previousPosition + i * stride);
+        rest.count = circles->count - i;
+        geometryBatchAddCirclesScalar(batch, &rest);
+    }
+#else
+    geometryBatchAddCirclesScalar(batch, circles);
+#endif
+}
+
+#endif // _GEOMETRY_BATCH_H
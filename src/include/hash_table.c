@@ -1,5 +1,20 @@
 // From https://github.com/benhoyt/ht/blob/master
 // Simple hash table implemented in C.
+//
+// Laid out like a Swiss table: next to the entries is an array of control
+// bytes, one per slot, either HT_EMPTY or the low 7 bits of the slot's key
+// hash. Probing is linear, but goes through the control bytes 16 at a time
+// with SSE2. A key is only compared with strcmp when both its 7 bit tag and
+// its full hash (stored in the entry) match, so looking up a missing key
+// almost never touches key memory. Stored hashes also let htResize move
+// entries without hashing their keys again.
+//
+// htRemove shifts the entries after the removed one back instead of leaving
+// a tombstone, so probes are as short after any amount of churn as in a
+// table that only ever had its current keys.
+//
+// The control array has HT_GROUP_SIZE - 1 more bytes mirroring the first
+// ones, so a group can be loaded at any slot without wrapping around.
 
 #include "hash_table.h"
 
@@ -8,20 +23,87 @@
 #include <stdlib.h>
 #include <string.h>
 
-// Hash table entry (slot may be filled or empty).
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Hash table entry, only meaningful if its control byte is not HT_EMPTY.
 typedef struct {
-    const char* key;  // key is NULL if this slot is empty
+    const char* key;
     void* value;
+    uint64_t hash;    // of key, see hashKey
 } HTEntry;
 
 // Hash table structure: create with ht_create, free with ht_destroy.
 struct HashTable {
-    HTEntry* entries;  // hash slots
-    size_t capacity;    // size of _entries array
+    HTEntry* entries;   // hash slots
+    uint8_t* control;   // capacity + HT_GROUP_SIZE - 1 control bytes
+    size_t capacity;    // size of _entries array, a power of two
     size_t length;      // number of items in hash table
+    size_t minCapacity; // shrinking stops here, see htReserve
+    bool canShrink;     // see htSetShrinking
 };
 
-#define INITIAL_CAPACITY 16  // must not be zero
+#define INITIAL_CAPACITY 16  // must be a power of two, at least HT_GROUP_SIZE
+#define HT_GROUP_SIZE 16
+#define HT_EMPTY 0x80        // full slots have the high bit clear
+
+// Slot to start probing from and the tag to look for. Different bits of
+// the hash, so slots of one probe don't share tags.
+static size_t htHomeSlot(uint64_t hash, size_t capacity) {
+    return (size_t)((hash >> 7) & (uint64_t)(capacity - 1));
+}
+
+static uint8_t htTag(uint64_t hash) {
+    return hash & 0x7F;
+}
+
+// Bit i set if control byte i of the group at control matches tag.
+static uint32_t htMatchTag(const uint8_t* control, uint8_t tag) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*)control);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+    uint32_t match = 0;
+    for (int i = 0; i < HT_GROUP_SIZE; i++) {
+        match |= (uint32_t)(control[i] == tag) << i;
+    }
+    return match;
+#endif
+}
+
+// Bit i set if slot i of the group at control is empty.
+static uint32_t htMatchEmpty(const uint8_t* control) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)control));
+#else
+    uint32_t match = 0;
+    for (int i = 0; i < HT_GROUP_SIZE; i++) {
+        match |= (uint32_t)(control[i] >> 7) << i;
+    }
+    return match;
+#endif
+}
+
+static void htSetControl(uint8_t* control, size_t capacity, size_t index, uint8_t value) {
+    control[index] = value;
+    if (index < HT_GROUP_SIZE - 1) {
+        control[capacity + index] = value;
+    }
+}
+
+// Allocate empty slots, false if out of memory.
+static bool htAllocate(HTEntry** entries, uint8_t** control, size_t capacity) {
+    *entries = malloc(capacity * sizeof(HTEntry));
+    *control = malloc(capacity + HT_GROUP_SIZE - 1);
+    if (*entries == NULL || *control == NULL) {
+        free(*entries);
+        free(*control);
+        return false;
+    }
+    memset(*control, HT_EMPTY, capacity + HT_GROUP_SIZE - 1);
+    return true;
+}
 
 HashTable* htCreate(void) {
     // Allocate space for hash table struct.
@@ -31,10 +113,11 @@ HashTable* htCreate(void) {
     }
     table->length = 0;
     table->capacity = INITIAL_CAPACITY;
+    table->minCapacity = INITIAL_CAPACITY;
+    table->canShrink = false;
 
-    // Allocate (zero'd) space for entry buckets.
-    table->entries = calloc(table->capacity, sizeof(HTEntry));
-    if (table->entries == NULL) {
+    // Allocate space for entry buckets, all empty.
+    if (!htAllocate(&table->entries, &table->control, table->capacity)) {
         free(table); // error, free table before we return!
         return NULL;
     }
@@ -44,14 +127,27 @@ HashTable* htCreate(void) {
 void htDestroy(HashTable* table) {
     // First free allocated keys.
     for (size_t i = 0; i < table->capacity; i++) {
-        free((void*)table->entries[i].key);
+        if (table->control[i] != HT_EMPTY) {
+            free((void*)table->entries[i].key);
+        }
     }
 
-    // Then free entries array and table itself.
+    // Then free slot arrays and table itself.
     free(table->entries);
+    free(table->control);
     free(table);
 }
 
+// strdup isn't part of C17, so copy keys without relying on POSIX.
+static char* htStrdup(const char* key) {
+    size_t size = strlen(key) + 1;
+    char* copy = malloc(size);
+    if (copy != NULL) {
+        memcpy(copy, key, size);
+    }
+    return copy;
+}
+
 #define FNV_OFFSET 14695981039346656037UL
 #define FNV_PRIME 1099511628211UL
 
@@ -66,87 +162,96 @@ static uint64_t hashKey(const char* key) {
     return hash;
 }
 
-void* htGet(HashTable* table, const char* key) {
-    // AND hash with capacity-1 to ensure it's within entries array.
-    uint64_t hash = hashKey(key);
-    size_t index = (size_t)(hash & (uint64_t)(table->capacity - 1));
+// Find the slot holding key, or the empty slot ending its probe. Returns
+// true if key was found.
+static bool htFind(const HashTable* table, const char* key, uint64_t hash, size_t* slot) {
+    size_t mask = table->capacity - 1;
+    uint8_t tag = htTag(hash);
+
+    for (size_t index = htHomeSlot(hash, table->capacity);; index = (index + HT_GROUP_SIZE) & mask) {
+        const uint8_t* group = &table->control[index];
+        uint32_t empty = htMatchEmpty(group);
+        // Slots past the first empty one belong to other probes.
+        uint32_t probed = empty ? (empty & -empty) - 1 : 0xFFFF;
 
-    // Loop till we find an empty entry.
-    while (table->entries[index].key != NULL) {
-        if (strcmp(key, table->entries[index].key) == 0) {
-            // Found key, return value.
-            return table->entries[index].value;
+        for (uint32_t match = htMatchTag(group, tag) & probed; match; match &= match - 1) {
+            size_t i = (index + __builtin_ctz(match)) & mask;
+            HTEntry* entry = &table->entries[i];
+            if (entry->hash == hash && strcmp(key, entry->key) == 0) {
+                *slot = i;
+                return true;
+            }
         }
-        // Key wasn't in this slot, move to next (linear probing).
-        index++;
-        if (index >= table->capacity) {
-            // At end of entries array, wrap around.
-            index = 0;
+
+        if (empty) {
+            *slot = (index + __builtin_ctz(empty)) & mask;
+            return false;
         }
     }
+}
+
+void* htGet(HashTable* table, const char* key) {
+    size_t slot;
+    if (htFind(table, key, hashKey(key), &slot)) {
+        return table->entries[slot].value;
+    }
     return NULL;
 }
 
 // Internal function to set an entry (without expanding table).
-static const char* htSetEntry(HTEntry* entries, size_t capacity,
-        const char* key, void* value, size_t* plength) {
-    // AND hash with capacity-1 to ensure it's within entries array.
+static const char* htSetEntry(HashTable* table, const char* key, void* value) {
     uint64_t hash = hashKey(key);
-    size_t index = (size_t)(hash & (uint64_t)(capacity - 1));
-
-    // Loop till we find an empty entry.
-    while (entries[index].key != NULL) {
-        if (strcmp(key, entries[index].key) == 0) {
-            // Found key (it already exists), update value.
-            entries[index].value = value;
-            return entries[index].key;
-        }
-        // Key wasn't in this slot, move to next (linear probing).
-        index++;
-        if (index >= capacity) {
-            // At end of entries array, wrap around.
-            index = 0;
-        }
+    size_t slot;
+    if (htFind(table, key, hash, &slot)) {
+        // Found key (it already exists), update value.
+        table->entries[slot].value = value;
+        return table->entries[slot].key;
     }
 
-    // Didn't find key, allocate+copy if needed, then insert it.
-    if (plength != NULL) {
-        key = strdup(key);
-        if (key == NULL) {
-            return NULL;
-        }
-        (*plength)++;
+    // Didn't find key, copy it and insert it in the empty slot.
+    key = htStrdup(key);
+    if (key == NULL) {
+        return NULL;
     }
-    entries[index].key = (char*)key;
-    entries[index].value = value;
+    table->entries[slot] = (HTEntry){key, value, hash};
+    htSetControl(table->control, table->capacity, slot, htTag(hash));
+    table->length++;
     return key;
 }
 
-// Expand hash table to twice its current size. Return true on success,
-// false if out of memory.
-static bool htExpand(HashTable* table) {
-    // Allocate new entries array.
-    size_t new_capacity = table->capacity * 2;
-    if (new_capacity < table->capacity) {
-        return false;  // overflow (capacity would be too big)
-    }
-    HTEntry* new_entries = calloc(new_capacity, sizeof(HTEntry));
-    if (new_entries == NULL) {
+// Move every entry to slot arrays of new_capacity, a power of two that
+// holds them. Return true on success, false if out of memory.
+static bool htResize(HashTable* table, size_t new_capacity) {
+    // Allocate new slot arrays.
+    assert(new_capacity >= INITIAL_CAPACITY && table->length < new_capacity);
+    HTEntry* new_entries;
+    uint8_t* new_control;
+    if (!htAllocate(&new_entries, &new_control, new_capacity)) {
         return false;
     }
 
-    // Iterate entries, move all non-empty ones to new table's entries.
+    // Move every entry to the first empty slot of its probe in the new
+    // arrays, by its stored hash. Keys are unique, so none are compared.
     for (size_t i = 0; i < table->capacity; i++) {
+        if (table->control[i] == HT_EMPTY) {
+            continue;
+        }
         HTEntry entry = table->entries[i];
-        if (entry.key != NULL) {
-            htSetEntry(new_entries, new_capacity, entry.key,
-                         entry.value, NULL);
+        size_t index = htHomeSlot(entry.hash, new_capacity);
+        uint32_t empty;
+        while (!(empty = htMatchEmpty(&new_control[index]))) {
+            index = (index + HT_GROUP_SIZE) & (new_capacity - 1);
         }
+        size_t slot = (index + __builtin_ctz(empty)) & (new_capacity - 1);
+        new_entries[slot] = entry;
+        htSetControl(new_control, new_capacity, slot, htTag(entry.hash));
     }
 
-    // Free old entries array and update this table's details.
+    // Free old slot arrays and update this table's details.
     free(table->entries);
+    free(table->control);
     table->entries = new_entries;
+    table->control = new_control;
     table->capacity = new_capacity;
     return true;
 }
@@ -157,16 +262,70 @@ const char* htSet(HashTable* table, const char* key, void* value) {
         return NULL;
     }
 
-    // If length will exceed half of current capacity, expand it.
-    if (table->length >= table->capacity / 2) {
-        if (!htExpand(table)) {
+    // If length will exceed 3/4 of current capacity, expand it. Probes
+    // scan a group at a time, so they stay short at that load.
+    if (table->length >= table->capacity / 4 * 3) {
+        size_t new_capacity = table->capacity * 2;
+        if (new_capacity < table->capacity) {
+            return NULL;  // overflow (capacity would be too big)
+        }
+        if (!htResize(table, new_capacity)) {
             return NULL;
         }
     }
 
     // Set entry and update length.
-    return htSetEntry(table->entries, table->capacity, key, value,
-                        &table->length);
+    return htSetEntry(table, key, value);
+}
+
+void* htRemove(HashTable* table, const char* key) {
+    size_t hole;
+    if (!htFind(table, key, hashKey(key), &hole)) {
+        return NULL;
+    }
+    void* value = table->entries[hole].value;
+    free((void*)table->entries[hole].key);
+    table->length--;
+
+    // Backward shift: pull each following entry of the cluster into the
+    // hole unless its home slot lies after the hole, then empty the last
+    // hole. Every probe still finds its key before an empty slot.
+    size_t mask = table->capacity - 1;
+    for (size_t i = (hole + 1) & mask; table->control[i] != HT_EMPTY; i = (i + 1) & mask) {
+        size_t home = htHomeSlot(table->entries[i].hash, table->capacity);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->entries[hole] = table->entries[i];
+            htSetControl(table->control, table->capacity, hole, table->control[i]);
+            hole = i;
+        }
+    }
+    htSetControl(table->control, table->capacity, hole, HT_EMPTY);
+
+    // Halve below 1/8 load, so the table is at most 1/4 full afterwards and
+    // a few inserts don't grow it right back. Failing to shrink is harmless.
+    if (table->canShrink && table->capacity > table->minCapacity && table->length < table->capacity / 8) {
+        htResize(table, table->capacity / 2);
+    }
+    return value;
+}
+
+bool htReserve(HashTable* table, size_t count) {
+    size_t capacity = INITIAL_CAPACITY;
+    while (capacity / 4 * 3 < count) {
+        if (capacity * 2 < capacity) {
+            return false;  // overflow (capacity would be too big)
+        }
+        capacity *= 2;
+    }
+    if (capacity > table->capacity && !htResize(table, capacity)) {
+        return false;
+    }
+    table->minCapacity = capacity;
+    return true;
+}
+
+void htSetShrinking(HashTable* table, bool canShrink) {
+    table->canShrink = canShrink;
 }
 
 size_t htLength(HashTable* table) {
@@ -186,7 +345,7 @@ bool htNext(hti* it) {
     while (it->_index < table->capacity) {
         size_t i = it->_index;
         it->_index++;
-        if (table->entries[i].key != NULL) {
+        if (table->control[i] != HT_EMPTY) {
             // Found next non-empty item, update iterator key and value.
             HTEntry entry = table->entries[i];
             it->key = entry.key;
@@ -195,4 +354,4 @@ bool htNext(hti* it) {
         }
     }
     return false;
-}
\ No newline at end of file
+}
@@ -25,6 +25,18 @@ void* htGet(HashTable* table, const char* key);
 // called). Return address of copied key, or NULL if out of memory.
 const char* htSet(HashTable* table, const char* key, void* value);
 
+// Remove item with given key (NUL-terminated) and free its copied key.
+// Return its value, or NULL if key not found. Don't call during iteration.
+void* htRemove(HashTable* table, const char* key);
+
+// Make room for count items, so inserting them doesn't expand the table,
+// and never shrink below that. Return false if out of memory.
+bool htReserve(HashTable* table, size_t count);
+
+// Let htRemove halve the table when it gets less than 1/8 full. Off by
+// default.
+void htSetShrinking(HashTable* table, bool canShrink);
+
 // Return number of items in hash table.
 size_t htLength(HashTable* table);
 
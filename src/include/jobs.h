@@ -0,0 +1,314 @@
+// Work-stealing job system with a small dependency graph on top.
+//
+// A JobGraph is an ordered list of systems. Each one declares bit masks of
+// the data it reads and writes, and depends on every earlier system it
+// conflicts with (write/write, read/write or write/read). Running the graph
+// therefore gives the same result as running the systems one after another
+// in the order they were added, but systems that don't conflict run at the
+// same time. A system over many items is split into chunks of a fixed size
+// that idle workers can steal, so chunking never depends on the thread count.
+//
+// Each worker owns a deque: it pushes and pops its own jobs at the bottom,
+// other workers steal from the top.
+
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define JOB_MAX_WORKERS 32
+#define JOB_DEQUE_CAPACITY 1024
+#define JOB_GRAPH_MAX_NODES 32
+
+// Process items [start, end) of a system.
+typedef void (*JobFunction)(void* data, unsigned int start, unsigned int end);
+
+typedef struct JobNode {
+    const char* name;
+    JobFunction function;
+    void* data;
+    unsigned int count;
+    unsigned int chunkSize;
+    uint32_t reads;
+    uint32_t writes;
+    unsigned int dependents[JOB_GRAPH_MAX_NODES];
+    unsigned int dependentCount;
+    unsigned int dependencyCount;
+    _Atomic unsigned int pendingDependencies;
+    _Atomic unsigned int pendingChunks;
+} JobNode;
+
+typedef struct JobGraph {
+    JobNode nodes[JOB_GRAPH_MAX_NODES];
+    unsigned int nodeCount;
+    _Atomic unsigned int pendingNodes;
+} JobGraph;
+
+typedef struct Job {
+    JobGraph* graph;
+    unsigned int node;
+    unsigned int start;
+    unsigned int end;
+} Job;
+
+typedef struct JobDeque {
+    pthread_mutex_t mutex;
+    Job jobs[JOB_DEQUE_CAPACITY];
+    unsigned int top;    // next job to steal
+    unsigned int bottom; // next free slot
+} JobDeque;
+
+typedef struct JobWorker {
+    struct JobSystem* system;
+    unsigned int index;
+    pthread_t thread;
+    JobDeque deque;
+} JobWorker;
+
+typedef struct JobSystem {
+    unsigned int workerCount; // worker 0 is the thread calling jobGraphRun
+    JobWorker workers[JOB_MAX_WORKERS];
+    pthread_mutex_t sleepMutex;
+    pthread_cond_t wake;
+    _Atomic unsigned int queuedJobs;
+    _Atomic bool shouldStop;
+} JobSystem;
+
+
+static inline unsigned int jobsHardwareThreadCount() {
+#ifdef _WIN32
+    long count = pthread_num_processors_np();
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return count > 0 ? count : 1;
+}
+
+
+static inline void jobDequePush(JobDeque* deque, Job job) {
+    pthread_mutex_lock(&deque->mutex);
+    assert(deque->bottom - deque->top < JOB_DEQUE_CAPACITY);
+    deque->jobs[deque->bottom % JOB_DEQUE_CAPACITY] = job;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->mutex);
+}
+
+static inline bool jobDequePop(JobDeque* deque, Job* job) {
+    pthread_mutex_lock(&deque->mutex);
+    bool hasJob = deque->bottom != deque->top;
+    if (hasJob) {
+        deque->bottom--;
+        *job = deque->jobs[deque->bottom % JOB_DEQUE_CAPACITY];
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return hasJob;
+}
+
+static inline bool jobDequeSteal(JobDeque* deque, Job* job) {
+    pthread_mutex_lock(&deque->mutex);
+    bool hasJob = deque->bottom != deque->top;
+    if (hasJob) {
+        *job = deque->jobs[deque->top % JOB_DEQUE_CAPACITY];
+        deque->top++;
+    }
+    pthread_mutex_unlock(&deque->mutex);
+    return hasJob;
+}
+
+
+static inline bool jobFindWork(JobWorker* worker, Job* job) {
+    JobSystem* system = worker->system;
+    bool found = jobDequePop(&worker->deque, job);
+
+    for (unsigned int i = 1; !found && i < system->workerCount; i++) {
+        JobWorker* victim = &system->workers[(worker->index + i) % system->workerCount];
+        found = jobDequeSteal(&victim->deque, job);
+    }
+
+    if (found) atomic_fetch_sub(&system->queuedJobs, 1);
+    return found;
+}
+
+static inline void jobScheduleNode(JobWorker* worker, JobGraph* graph, unsigned int nodeIndex);
+
+static inline void jobCompleteNode(JobWorker* worker, JobGraph* graph, unsigned int nodeIndex) {
+    JobNode* node = &graph->nodes[nodeIndex];
+    for (unsigned int i = 0; i < node->dependentCount; i++) {
+        unsigned int dependent = node->dependents[i];
+        if (atomic_fetch_sub(&graph->nodes[dependent].pendingDependencies, 1) == 1) {
+            jobScheduleNode(worker, graph, dependent);
+        }
+    }
+    atomic_fetch_sub(&graph->pendingNodes, 1);
+}
+
+// Push every chunk of a node whose dependencies are done.
+static inline void jobScheduleNode(JobWorker* worker, JobGraph* graph, unsigned int nodeIndex) {
+    JobNode* node = &graph->nodes[nodeIndex];
+    if (node->count == 0) {
+        jobCompleteNode(worker, graph, nodeIndex);
+        return;
+    }
+
+    unsigned int chunkCount = (node->count + node->chunkSize - 1) / node->chunkSize;
+    atomic_store(&node->pendingChunks, chunkCount);
+
+    JobSystem* system = worker->system;
+    atomic_fetch_add(&system->queuedJobs, chunkCount);
+
+    // Pushed back to front, so the owner pops them in order.
+    for (unsigned int i = chunkCount; i-- > 0;) {
+        unsigned int start = i * node->chunkSize;
+        unsigned int end = start + node->chunkSize < node->count ? start + node->chunkSize : node->count;
+        jobDequePush(&worker->deque, (Job){graph, nodeIndex, start, end});
+    }
+
+    if (system->workerCount > 1) {
+        pthread_mutex_lock(&system->sleepMutex);
+        pthread_cond_broadcast(&system->wake);
+        pthread_mutex_unlock(&system->sleepMutex);
+    }
+}
+
+static inline void jobExecute(JobWorker* worker, Job job) {
+    JobNode* node = &job.graph->nodes[job.node];
+    node->function(node->data, job.start, job.end);
+
+    if (atomic_fetch_sub(&node->pendingChunks, 1) == 1) {
+        jobCompleteNode(worker, job.graph, job.node);
+    }
+}
+
+static inline void* jobWorkerRun(void* data) {
+    JobWorker* worker = data;
+    JobSystem* system = worker->system;
+
+    while (!atomic_load(&system->shouldStop)) {
+        Job job;
+        if (jobFindWork(worker, &job)) {
+            jobExecute(worker, job);
+            continue;
+        }
+
+        pthread_mutex_lock(&system->sleepMutex);
+        while (atomic_load(&system->queuedJobs) == 0 && !atomic_load(&system->shouldStop)) {
+            pthread_cond_wait(&system->wake, &system->sleepMutex);
+        }
+        pthread_mutex_unlock(&system->sleepMutex);
+    }
+
+    return NULL;
+}
+
+
+// Start workerCount - 1 threads; the thread running graphs is the last worker.
+static inline void jobSystemInit(JobSystem* system, unsigned int workerCount) {
+    assert(workerCount >= 1);
+    system->workerCount = workerCount < JOB_MAX_WORKERS ? workerCount : JOB_MAX_WORKERS;
+    pthread_mutex_init(&system->sleepMutex, NULL);
+    pthread_cond_init(&system->wake, NULL);
+    atomic_init(&system->queuedJobs, 0);
+    atomic_init(&system->shouldStop, false);
+
+    for (unsigned int i = 0; i < system->workerCount; i++) {
+        JobWorker* worker = &system->workers[i];
+        worker->system = system;
+        worker->index = i;
+        pthread_mutex_init(&worker->deque.mutex, NULL);
+        worker->deque.top = 0;
+        worker->deque.bottom = 0;
+    }
+
+    for (unsigned int i = 1; i < system->workerCount; i++) {
+        pthread_create(&system->workers[i].thread, NULL, jobWorkerRun, &system->workers[i]);
+    }
+}
+
+static inline void jobSystemClean(JobSystem* system) {
+    pthread_mutex_lock(&system->sleepMutex);
+    atomic_store(&system->shouldStop, true);
+    pthread_cond_broadcast(&system->wake);
+    pthread_mutex_unlock(&system->sleepMutex);
+
+    for (unsigned int i = 1; i < system->workerCount; i++) {
+        pthread_join(system->workers[i].thread, NULL);
+    }
+
+    for (unsigned int i = 0; i < system->workerCount; i++) {
+        pthread_mutex_destroy(&system->workers[i].deque.mutex);
+    }
+    pthread_mutex_destroy(&system->sleepMutex);
+    pthread_cond_destroy(&system->wake);
+}
+
+
+static inline void jobGraphClear(JobGraph* graph) {
+    graph->nodeCount = 0;
+}
+
+// Add a system processing count items in chunks of chunkSize. It will run
+// after every system added before it that touches the same data.
+static inline unsigned int jobGraphAdd(JobGraph* graph, const char* name, JobFunction function, void* data, unsigned int count, unsigned int chunkSize, uint32_t reads, uint32_t writes) {
+    assert(graph->nodeCount < JOB_GRAPH_MAX_NODES);
+    assert(chunkSize > 0);
+
+    unsigned int nodeIndex = graph->nodeCount++;
+    JobNode* node = &graph->nodes[nodeIndex];
+    node->name = name;
+    node->function = function;
+    node->data = data;
+    node->count = count;
+    node->chunkSize = chunkSize;
+    node->reads = reads;
+    node->writes = writes;
+    node->dependentCount = 0;
+    node->dependencyCount = 0;
+
+    for (unsigned int i = 0; i < nodeIndex; i++) {
+        JobNode* other = &graph->nodes[i];
+        bool conflicts = (other->writes & (reads | writes)) || (other->reads & writes);
+        if (conflicts) {
+            other->dependents[other->dependentCount++] = nodeIndex;
+            node->dependencyCount++;
+        }
+    }
+
+    return nodeIndex;
+}
+
+// Run the graph to completion. The calling thread works as worker 0, so only
+// one thread may run graphs on a system.
+static inline void jobGraphRun(JobSystem* system, JobGraph* graph) {
+    JobWorker* worker = &system->workers[0];
+
+    for (unsigned int i = 0; i < graph->nodeCount; i++) {
+        atomic_store(&graph->nodes[i].pendingDependencies, graph->nodes[i].dependencyCount);
+    }
+    atomic_store(&graph->pendingNodes, graph->nodeCount);
+
+    for (unsigned int i = 0; i < graph->nodeCount; i++) {
+        if (graph->nodes[i].dependencyCount == 0) {
+            jobScheduleNode(worker, graph, i);
+        }
+    }
+
+    while (atomic_load(&graph->pendingNodes) > 0) {
+        Job job;
+        if (jobFindWork(worker, &job)) {
+            jobExecute(worker, job);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+#endif // _JOBS_H
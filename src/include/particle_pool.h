@@ -0,0 +1,253 @@
+// Fixed capacity pool of particles stored as one array of floats per field.
+//
+// Live particles are always [0, count). A step moves all of them four at a
+// time with SSE2 and notes the ones that die; those are then retired by
+// moving the last live particle into their slot, so there is never a pass
+// over the pool to compact it. The order of particles is not kept.
+//
+// Every kind of particle follows the same motion: gravity, then damping, then
+// the new velocity moves it. What differs is in a ParticleMotion: how strong
+// each is, how long particles live and how they die with respect to water.
+
+#ifndef _PARTICLE_POOL_H
+#define _PARTICLE_POOL_H
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define PARTICLE_FLAG_SURFACED 1 // has been out of the water since it spawned
+
+typedef enum ParticleField {
+    PARTICLE_X,
+    PARTICLE_Y,
+    PARTICLE_PREVIOUS_X, // before the last step, for render interpolation
+    PARTICLE_PREVIOUS_Y,
+    PARTICLE_VELOCITY_X,
+    PARTICLE_VELOCITY_Y,
+    PARTICLE_LIFETIME,   // seconds since spawning
+    PARTICLE_SIZE,
+    PARTICLE_FIELD_COUNT,
+} ParticleField;
+
+typedef enum ParticleWaterRule {
+    PARTICLE_DIES_OUT_OF_WATER,
+    PARTICLE_DIES_BACK_IN_WATER, // once surfaced
+} ParticleWaterRule;
+
+typedef struct ParticleMotion {
+    float gravity;     // added to the y velocity per second
+    float damping;     // left of the velocity after a second, 1 for none
+    float maxLifetime; // INFINITY for none
+    ParticleWaterRule waterRule;
+    float waterX, waterY, waterWidth, waterHeight;
+} ParticleMotion;
+
+typedef struct ParticlePool {
+    float* fields[PARTICLE_FIELD_COUNT]; // capacity floats each
+    uint32_t* flags;                     // PARTICLE_FLAG_*
+    uint32_t* dying;                     // indices found dead by the last step
+    uint32_t count;
+    uint32_t capacity;
+} ParticlePool;
+
+// One particle copied out of a pool, for snapshots.
+typedef struct Particle {
+    float x, y;
+    float previousX, previousY;
+    float velocityX, velocityY;
+    float lifetime;
+    float size;
+    uint32_t flags;
+} Particle;
+
+
+static inline void particlePoolInit(ParticlePool* pool, uint32_t capacity) {
+    for (int field = 0; field < PARTICLE_FIELD_COUNT; field++) {
+        pool->fields[field] = malloc(capacity * sizeof(float));
+    }
+    pool->flags = malloc(capacity * sizeof(uint32_t));
+    pool->dying = malloc(capacity * sizeof(uint32_t));
+    pool->count = 0;
+    pool->capacity = capacity;
+}
+
+static inline void particlePoolFree(ParticlePool* pool) {
+    for (int field = 0; field < PARTICLE_FIELD_COUNT; field++) {
+        free(pool->fields[field]);
+    }
+    free(pool->flags);
+    free(pool->dying);
+    *pool = (ParticlePool){0};
+}
+
+// False, and nothing spawned, if the pool is full.
+static inline bool particlePoolSpawn(ParticlePool* pool, float x, float y, float velocityX, float velocityY, float size) {
+    if (pool->count == pool->capacity) return false;
+    uint32_t i = pool->count++;
+    pool->fields[PARTICLE_X][i] = x;
+    pool->fields[PARTICLE_Y][i] = y;
+    pool->fields[PARTICLE_PREVIOUS_X][i] = x;
+    pool->fields[PARTICLE_PREVIOUS_Y][i] = y;
+    pool->fields[PARTICLE_VELOCITY_X][i] = velocityX;
+    pool->fields[PARTICLE_VELOCITY_Y][i] = velocityY;
+    pool->fields[PARTICLE_LIFETIME][i] = 0;
+    pool->fields[PARTICLE_SIZE][i] = size;
+    pool->flags[i] = 0;
+    return true;
+}
+
+static inline void particlePoolCopyOut(const ParticlePool* pool, Particle* particles) {
+    for (uint32_t i = 0; i < pool->count; i++) {
+        particles[i] = (Particle){
+            pool->fields[PARTICLE_X][i], pool->fields[PARTICLE_Y][i],
+            pool->fields[PARTICLE_PREVIOUS_X][i], pool->fields[PARTICLE_PREVIOUS_Y][i],
+            pool->fields[PARTICLE_VELOCITY_X][i], pool->fields[PARTICLE_VELOCITY_Y][i],
+            pool->fields[PARTICLE_LIFETIME][i], pool->fields[PARTICLE_SIZE][i],
+            pool->flags[i],
+        };
+    }
+}
+
+// Replace the particles of pool, false if there are more than it holds.
+static inline bool particlePoolCopyIn(ParticlePool* pool, const Particle* particles, size_t count) {
+    if (count > pool->capacity) return false;
+    for (size_t i = 0; i < count; i++) {
+        const Particle* particle = &particles[i];
+        pool->fields[PARTICLE_X][i] = particle->x;
+        pool->fields[PARTICLE_Y][i] = particle->y;
+        pool->fields[PARTICLE_PREVIOUS_X][i] = particle->previousX;
+        pool->fields[PARTICLE_PREVIOUS_Y][i] = particle->previousY;
+        pool->fields[PARTICLE_VELOCITY_X][i] = particle->velocityX;
+        pool->fields[PARTICLE_VELOCITY_Y][i] = particle->velocityY;
+        pool->fields[PARTICLE_LIFETIME][i] = particle->lifetime;
+        pool->fields[PARTICLE_SIZE][i] = particle->size;
+        pool->flags[i] = particle->flags;
+    }
+    pool->count = count;
+    return true;
+}
+
+// Move the last live particle into each dying slot. Going from the highest
+// dying index down, everything past the slot is alive by then.
+static inline void particlePoolRetire(ParticlePool* pool, uint32_t dyingCount) {
+    for (uint32_t d = dyingCount; d-- > 0;) {
+        uint32_t i = pool->dying[d];
+        uint32_t last = --pool->count;
+        if (i == last) continue;
+        for (int field = 0; field < PARTICLE_FIELD_COUNT; field++) {
+            pool->fields[field][i] = pool->fields[field][last];
+        }
+        pool->flags[i] = pool->flags[last];
+    }
+}
+
+// Step particle i, true if it died.
+static inline bool particleStep(ParticlePool* pool, const ParticleMotion* motion, uint32_t i, float damping, float delta) {
+    float* x = &pool->fields[PARTICLE_X][i];
+    float* y = &pool->fields[PARTICLE_Y][i];
+    float* velocityX = &pool->fields[PARTICLE_VELOCITY_X][i];
+    float* velocityY = &pool->fields[PARTICLE_VELOCITY_Y][i];
+    float* lifetime = &pool->fields[PARTICLE_LIFETIME][i];
+
+    *velocityX = *velocityX * damping;
+    *velocityY = (*velocityY + motion->gravity * delta) * damping;
+    *lifetime += delta;
+    pool->fields[PARTICLE_PREVIOUS_X][i] = *x;
+    pool->fields[PARTICLE_PREVIOUS_Y][i] = *y;
+    *x += *velocityX * delta;
+    *y += *velocityY * delta;
+
+    float waterRight = motion->waterX + motion->waterWidth;
+    float waterBottom = motion->waterY + motion->waterHeight;
+    bool isInWater = *x >= motion->waterX && *x < waterRight && *y >= motion->waterY && *y < waterBottom;
+    if (!isInWater) pool->flags[i] |= PARTICLE_FLAG_SURFACED;
+
+    bool isDrowned = motion->waterRule == PARTICLE_DIES_BACK_IN_WATER && isInWater && (pool->flags[i] & PARTICLE_FLAG_SURFACED);
+    bool isStranded = motion->waterRule == PARTICLE_DIES_OUT_OF_WATER && !isInWater;
+    return *lifetime >= motion->maxLifetime || isDrowned || isStranded;
+}
+
+// Reference version of particlePoolStep.
+static inline void particlePoolStepScalar(ParticlePool* pool, const ParticleMotion* motion, float delta) {
+    float damping = powf(motion->damping, delta);
+    uint32_t dyingCount = 0;
+    for (uint32_t i = 0; i < pool->count; i++) {
+        if (particleStep(pool, motion, i, damping, delta)) pool->dying[dyingCount++] = i;
+    }
+    particlePoolRetire(pool, dyingCount);
+}
+
+// Move every particle by delta seconds and retire the dead. Same output as
+// particlePoolStepScalar, four particles per step with SSE2.
+static inline void particlePoolStep(ParticlePool* pool, const ParticleMotion* motion, float delta) {
+#ifdef __SSE2__
+    float damping = powf(motion->damping, delta);
+    __m128 damping4 = _mm_set1_ps(damping);
+    __m128 delta4 = _mm_set1_ps(delta);
+    __m128 gravity4 = _mm_set1_ps(motion->gravity * delta);
+    __m128 maxLifetime4 = _mm_set1_ps(motion->maxLifetime);
+    __m128 waterLeft = _mm_set1_ps(motion->waterX);
+    __m128 waterTop = _mm_set1_ps(motion->waterY);
+    __m128 waterRight = _mm_set1_ps(motion->waterX + motion->waterWidth);
+    __m128 waterBottom = _mm_set1_ps(motion->waterY + motion->waterHeight);
+    __m128i surfaced = _mm_set1_epi32(PARTICLE_FLAG_SURFACED);
+    __m128i diesBackInWater = _mm_set1_epi32(motion->waterRule == PARTICLE_DIES_BACK_IN_WATER ? -1 : 0);
+    __m128i diesOutOfWater = _mm_set1_epi32(motion->waterRule == PARTICLE_DIES_OUT_OF_WATER ? -1 : 0);
+
+    float* xs = pool->fields[PARTICLE_X];
+    float* ys = pool->fields[PARTICLE_Y];
+    float* velocityXs = pool->fields[PARTICLE_VELOCITY_X];
+    float* velocityYs = pool->fields[PARTICLE_VELOCITY_Y];
+    float* lifetimes = pool->fields[PARTICLE_LIFETIME];
+
+    uint32_t dyingCount = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= pool->count; i += 4) {
+        __m128 velocityX = _mm_mul_ps(_mm_loadu_ps(velocityXs + i), damping4);
+        __m128 velocityY = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(velocityYs + i), gravity4), damping4);
+        __m128 lifetime = _mm_add_ps(_mm_loadu_ps(lifetimes + i), delta4);
+        __m128 x = _mm_loadu_ps(xs + i);
+        __m128 y = _mm_loadu_ps(ys + i);
+        _mm_storeu_ps(pool->fields[PARTICLE_PREVIOUS_X] + i, x);
+        _mm_storeu_ps(pool->fields[PARTICLE_PREVIOUS_Y] + i, y);
+        x = _mm_add_ps(x, _mm_mul_ps(velocityX, delta4));
+        y = _mm_add_ps(y, _mm_mul_ps(velocityY, delta4));
+        _mm_storeu_ps(velocityXs + i, velocityX);
+        _mm_storeu_ps(velocityYs + i, velocityY);
+        _mm_storeu_ps(lifetimes + i, lifetime);
+        _mm_storeu_ps(xs + i, x);
+        _mm_storeu_ps(ys + i, y);
+
+        __m128i isInWater = _mm_castps_si128(_mm_and_ps(
+            _mm_and_ps(_mm_cmpge_ps(x, waterLeft), _mm_cmplt_ps(x, waterRight)),
+            _mm_and_ps(_mm_cmpge_ps(y, waterTop), _mm_cmplt_ps(y, waterBottom))));
+        __m128i flags = _mm_or_si128(_mm_loadu_si128((__m128i*) (pool->flags + i)), _mm_andnot_si128(isInWater, surfaced));
+        _mm_storeu_si128((__m128i*) (pool->flags + i), flags);
+
+        __m128i isDrowned = _mm_and_si128(_mm_and_si128(isInWater, diesBackInWater), _mm_cmpeq_epi32(_mm_and_si128(flags, surfaced), surfaced));
+        __m128i isStranded = _mm_andnot_si128(isInWater, diesOutOfWater);
+        __m128 isDead = _mm_or_ps(_mm_cmpge_ps(lifetime, maxLifetime4), _mm_castsi128_ps(_mm_or_si128(isDrowned, isStranded)));
+
+        int deadLanes = _mm_movemask_ps(isDead);
+        for (uint32_t lane = 0; deadLanes; lane++, deadLanes >>= 1) {
+            if (deadLanes & 1) pool->dying[dyingCount++] = i + lane;
+        }
+    }
+    for (; i < pool->count; i++) {
+        if (particleStep(pool, motion, i, damping, delta)) pool->dying[dyingCount++] = i;
+    }
+    particlePoolRetire(pool, dyingCount);
+#else
+    particlePoolStepScalar(pool, motion, delta);
+#endif
+}
+
+#endif // _PARTICLE_POOL_H
@@ -0,0 +1,66 @@
+// Small deterministic random number generator (PCG32, XSH-RR variant).
+// See: https://www.pcg-random.org/
+
+#ifndef _RNG_H
+#define _RNG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Generator state: create with rngCreate, never shared between threads.
+typedef struct Rng {
+    uint64_t state;
+    uint64_t increment;  // stream selector, always odd
+} Rng;
+
+#define RNG_MULTIPLIER 6364136223846793005ULL
+
+// SplitMix64 finalizer, used to turn seeds and keys into well mixed bits.
+static inline uint64_t rngMix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static inline uint32_t rngNext(Rng* rng) {
+    uint64_t oldState = rng->state;
+    rng->state = oldState * RNG_MULTIPLIER + rng->increment;
+    uint32_t xorShifted = (uint32_t) (((oldState >> 18) ^ oldState) >> 27);
+    uint32_t rotation = (uint32_t) (oldState >> 59);
+    return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31));
+}
+
+// Create generator for the given seed. Different streams with the same seed
+// produce unrelated sequences.
+static inline Rng rngCreate(uint64_t seed, uint64_t stream) {
+    Rng rng;
+    rng.state = 0;
+    rng.increment = (rngMix(stream) << 1) | 1;
+    rngNext(&rng);
+    rng.state += rngMix(seed);
+    rngNext(&rng);
+    return rng;
+}
+
+// Derive an independent substream from parent without advancing it. Key the
+// substream by work item (chunk index, entity index, ...), never by worker
+// thread, so results don't depend on how many threads picked up the work.
+static inline Rng rngDerive(const Rng* parent, uint64_t key) {
+    return rngCreate(parent->state ^ rngMix(key), parent->increment ^ key);
+}
+
+// Uniform float in [0, 1).
+static inline float rngFloat(Rng* rng) {
+    return (rngNext(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+static inline float rngRange(Rng* rng, float rangeMin, float rangeMax) {
+    return rangeMin + (rangeMax - rangeMin) * rngFloat(rng);
+}
+
+static inline bool rngBool(Rng* rng) {
+    return rngNext(rng) >> 31;
+}
+
+#endif // _RNG_H
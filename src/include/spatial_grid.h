@@ -0,0 +1,118 @@
+// Uniform grid for rectangle queries over a copy of an array of items.
+//
+// Instead of keeping lists per cell, spatialGridSort copies the items in cell
+// order (a counting sort) and keeps where each cell starts. The cells of one
+// grid row are then next to each other, so every row of a query is a single
+// contiguous range of the sorted copy, ready to be processed as an array.
+//
+// Items outside the grid go to the nearest edge cell, so nothing is lost and
+// a query reaching past the edge finds them.
+
+#ifndef _SPATIAL_GRID_H
+#define _SPATIAL_GRID_H
+
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct SpatialGrid {
+    float originX, originY;
+    float cellSize;
+    unsigned int columns, rows;
+    uint32_t* cellStarts;  // columns * rows + 1 offsets into the sorted items
+    uint32_t* itemCells;   // cell of every item, while sorting
+    size_t cellCapacity;
+    size_t itemCapacity;
+} SpatialGrid;
+
+// Rows and columns of cells overlapping a rectangle, inclusive.
+typedef struct SpatialGridRange {
+    unsigned int firstColumn, lastColumn;
+    unsigned int firstRow, lastRow;
+} SpatialGridRange;
+
+
+static inline void spatialGridFree(SpatialGrid* grid) {
+    free(grid->cellStarts);
+    free(grid->itemCells);
+    *grid = (SpatialGrid){0};
+}
+
+static inline unsigned int spatialGridClamp(float cell, unsigned int count) {
+    if (!(cell > 0)) return 0;  // also NaN
+    return cell < count ? (unsigned int) cell : count - 1;
+}
+
+static inline unsigned int spatialGridCellOf(const SpatialGrid* grid, float x, float y) {
+    unsigned int column = spatialGridClamp(floorf((x - grid->originX) / grid->cellSize), grid->columns);
+    unsigned int row = spatialGridClamp(floorf((y - grid->originY) / grid->cellSize), grid->rows);
+    return row * grid->columns + column;
+}
+
+// Cover width x height from the origin with square cells.
+static inline void spatialGridResize(SpatialGrid* grid, float originX, float originY, float width, float height, float cellSize) {
+    assert(cellSize > 0);
+    grid->originX = originX;
+    grid->originY = originY;
+    grid->cellSize = cellSize;
+    grid->columns = fmaxf(1, ceilf(width / cellSize));
+    grid->rows = fmaxf(1, ceilf(height / cellSize));
+
+    size_t cellCount = (size_t) grid->columns * grid->rows + 1;
+    if (cellCount > grid->cellCapacity) {
+        grid->cellStarts = realloc(grid->cellStarts, cellCount * sizeof(uint32_t));
+        grid->cellCapacity = cellCount;
+    }
+}
+
+// Copy count items of itemSize bytes into sorted, ordered by the cell of the
+// x, y floats at positionOffset in each item. Keeps the order within a cell.
+static inline void spatialGridSort(SpatialGrid* grid, const void* items, void* sorted, size_t count, size_t itemSize, size_t positionOffset) {
+    assert(count < UINT32_MAX);
+    size_t cellCount = (size_t) grid->columns * grid->rows;
+    if (count > grid->itemCapacity) {
+        grid->itemCells = realloc(grid->itemCells, count * sizeof(uint32_t));
+        grid->itemCapacity = count;
+    }
+
+    memset(grid->cellStarts, 0, (cellCount + 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < count; i++) {
+        const float* position = (const float*) ((const char*) items + i * itemSize + positionOffset);
+        uint32_t cell = spatialGridCellOf(grid, position[0], position[1]);
+        grid->itemCells[i] = cell;
+        grid->cellStarts[cell + 1]++;
+    }
+
+    for (size_t cell = 0; cell < cellCount; cell++) {
+        grid->cellStarts[cell + 1] += grid->cellStarts[cell];
+    }
+
+    // Each start is its cell's write cursor and ends up at the start of the
+    // next cell, so shifting them all by one restores the starts.
+    for (size_t i = 0; i < count; i++) {
+        uint32_t slot = grid->cellStarts[grid->itemCells[i]]++;
+        memcpy((char*) sorted + (size_t) slot * itemSize, (const char*) items + i * itemSize, itemSize);
+    }
+    memmove(grid->cellStarts + 1, grid->cellStarts, cellCount * sizeof(uint32_t));
+    grid->cellStarts[0] = 0;
+}
+
+static inline SpatialGridRange spatialGridQuery(const SpatialGrid* grid, float minX, float minY, float maxX, float maxY) {
+    return (SpatialGridRange){
+        spatialGridClamp(floorf((minX - grid->originX) / grid->cellSize), grid->columns),
+        spatialGridClamp(floorf((maxX - grid->originX) / grid->cellSize), grid->columns),
+        spatialGridClamp(floorf((minY - grid->originY) / grid->cellSize), grid->rows),
+        spatialGridClamp(floorf((maxY - grid->originY) / grid->cellSize), grid->rows),
+    };
+}
+
+// Sorted items [*start, *end) in the range's columns of row.
+static inline void spatialGridRowItems(const SpatialGrid* grid, SpatialGridRange range, unsigned int row, size_t* start, size_t* end) {
+    *start = grid->cellStarts[row * grid->columns + range.firstColumn];
+    *end = grid->cellStarts[row * grid->columns + range.lastColumn + 1];
+}
+
+#endif // _SPATIAL_GRID_H
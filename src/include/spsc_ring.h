@@ -0,0 +1,59 @@
+// Lock-free single producer, single consumer ring. One thread pushes, one
+// other thread pops; neither ever waits. A full ring makes the push fail
+// instead of blocking.
+//
+// Like the triple buffer, the ring only manages slot indices. The slots are
+// owned by the caller, usually an array of capacity values.
+
+#ifndef _SPSC_RING_H
+#define _SPSC_RING_H
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t capacity;       // power of two
+    _Atomic uint32_t head;   // next slot to write, only advanced by the producer
+    _Atomic uint32_t tail;   // next slot to read, only advanced by the consumer
+} SpscRing;
+
+static inline void spscInit(SpscRing* ring, uint32_t capacity) {
+    assert(capacity && (capacity & (capacity - 1)) == 0);
+    ring->capacity = capacity;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+// Producer: get the slot to fill, or false if the ring is full.
+static inline bool spscReserve(SpscRing* ring, uint32_t* index) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == ring->capacity) return false;
+    *index = head & (ring->capacity - 1);
+    return true;
+}
+
+// Producer: hand the filled slot to the consumer.
+static inline void spscCommit(SpscRing* ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Consumer: get the oldest filled slot, or false if the ring is empty.
+static inline bool spscPeek(SpscRing* ring, uint32_t* index) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail) return false;
+    *index = tail & (ring->capacity - 1);
+    return true;
+}
+
+// Consumer: give the peeked slot back to the producer.
+static inline void spscRelease(SpscRing* ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+#endif // _SPSC_RING_H
@@ -0,0 +1,54 @@
+// Lock-free triple buffer: hands the latest of a stream of values from one
+// writer thread to one reader thread. Neither side ever waits; the reader
+// skips values it was too slow to see.
+//
+// The buffer only manages slot indices, the slots themselves are owned by
+// the caller (usually an array of 3 values indexed by tbWriteIndex/tbReadIndex).
+
+#ifndef _TRIPLE_BUFFER_H
+#define _TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRIPLE_BUFFER_FRESH 4u // set on the middle index when it holds an unread value
+
+typedef struct {
+    uint32_t back;           // slot owned by the writer
+    _Atomic uint32_t middle; // slot in transit, plus TRIPLE_BUFFER_FRESH
+    uint32_t front;          // slot owned by the reader
+} TripleBuffer;
+
+static inline void tbInit(TripleBuffer* tb) {
+    tb->back = 0;
+    atomic_init(&tb->middle, 1);
+    tb->front = 2;
+}
+
+// Slot the writer may fill.
+static inline uint32_t tbWriteIndex(TripleBuffer* tb) {
+    return tb->back;
+}
+
+// Make the filled write slot the latest value and take a new slot to write.
+static inline void tbPublish(TripleBuffer* tb) {
+    tb->back = atomic_exchange_explicit(&tb->middle, tb->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel) & ~TRIPLE_BUFFER_FRESH;
+}
+
+// Swap in the latest value if there's one the reader hasn't seen. Return
+// true if the read slot changed.
+static inline bool tbAcquire(TripleBuffer* tb) {
+    if (!(atomic_load_explicit(&tb->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH)) {
+        return false;
+    }
+    tb->front = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel) & ~TRIPLE_BUFFER_FRESH;
+    return true;
+}
+
+// Slot the reader may read, stable until the next tbAcquire.
+static inline uint32_t tbReadIndex(TripleBuffer* tb) {
+    return tb->front;
+}
+
+#endif // _TRIPLE_BUFFER_H
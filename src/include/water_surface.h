@@ -0,0 +1,179 @@
+// Kernels for a water surface stored as arrays of floats, one entry per node.
+//
+// The springs are stepped Jacobi style: every node's new velocity only reads
+// the offsets of the previous step, so the new offsets go to a second buffer
+// and nodes can be updated in any order, four at a time with SSE2. Steps
+// take a range of nodes, so parts of the surface at rest can be skipped.
+// That step is only stable while delta is small next to the springs' period;
+// waterSpringSolveImplicit takes a backward Euler step instead, stable at
+// any delta, by solving the tridiagonal system it makes along the surface.
+//
+// Waves are sums of sines travelling along the surface. The spatial part of
+// a wave only depends on the node, so it's kept as a table of phasors, the
+// sin and cos of its phase at every node. A step rotates them by the wave's
+// phase at that time: no sin per node, two multiplies per node and wave.
+
+#ifndef _WATER_SURFACE_H
+#define _WATER_SURFACE_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define WATER_TAU 6.283185307179586
+
+// Node i is pulled back to rest and towards each neighbor with stiffness
+// (spring constant times delta), then damped and moved by its new velocity.
+static inline void waterSpringNode(const float* offsets, float* nextOffsets, float* velocities, size_t count, size_t i, float stiffness, float damping, float delta) {
+    float offset = offsets[i];
+    float pull = -offset;
+    if (i > 0) pull += offsets[i - 1] - offset;
+    if (i + 1 < count) pull += offsets[i + 1] - offset;
+    float velocity = (velocities[i] + stiffness * pull) * damping;
+    velocities[i] = velocity;
+    nextOffsets[i] = offset + velocity * delta;
+}
+
+// Reference version of waterSpringStep.
+static inline void waterSpringStepScalar(const float* offsets, float* nextOffsets, float* velocities, size_t count, size_t start, size_t end, float stiffness, float damping, float delta) {
+    for (size_t i = start; i < end; i++) {
+        waterSpringNode(offsets, nextOffsets, velocities, count, i, stiffness, damping, delta);
+    }
+}
+
+// Step nodes [start, end) of count. Same output as waterSpringStepScalar,
+// four inner nodes per step with SSE2.
+static inline void waterSpringStep(const float* offsets, float* nextOffsets, float* velocities, size_t count, size_t start, size_t end, float stiffness, float damping, float delta) {
+#ifdef __SSE2__
+    __m128 stiffness4 = _mm_set1_ps(stiffness);
+    __m128 damping4 = _mm_set1_ps(damping);
+    __m128 delta4 = _mm_set1_ps(delta);
+    __m128 signBit = _mm_set1_ps(-0.0f);
+
+    size_t i = start;
+    if (i == 0 && i < end) {
+        waterSpringNode(offsets, nextOffsets, velocities, count, 0, stiffness, damping, delta);
+        i++;
+    }
+    for (; i + 4 <= end && i + 4 < count; i += 4) {
+        __m128 offset = _mm_loadu_ps(offsets + i);
+        __m128 left = _mm_loadu_ps(offsets + i - 1);
+        __m128 right = _mm_loadu_ps(offsets + i + 1);
+        __m128 pull = _mm_xor_ps(offset, signBit);
+        pull = _mm_add_ps(pull, _mm_sub_ps(left, offset));
+        pull = _mm_add_ps(pull, _mm_sub_ps(right, offset));
+        __m128 velocity = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(velocities + i), _mm_mul_ps(stiffness4, pull)), damping4);
+        _mm_storeu_ps(velocities + i, velocity);
+        _mm_storeu_ps(nextOffsets + i, _mm_add_ps(offset, _mm_mul_ps(velocity, delta4)));
+    }
+    for (; i < end; i++) {
+        waterSpringNode(offsets, nextOffsets, velocities, count, i, stiffness, damping, delta);
+    }
+#else
+    waterSpringStepScalar(offsets, nextOffsets, velocities, count, start, end, stiffness, damping, delta);
+#endif
+}
+
+// Backward Euler version of waterSpringStep: the pull uses the new offsets,
+//   v' = damping (v - stiffness A x')  and  x' = x + delta v'
+// with A x the pull of waterSpringNode negated. So
+//   (I + damping stiffness delta A) x' = x + delta damping v
+// is solved with the Thomas algorithm. The system is diagonally dominant, so
+// it needs no pivoting. Nodes outside [start, end) are held where they are,
+// they should be at rest. velocities holds the eliminated upper diagonal
+// during the solve, once each node's own velocity has been read.
+static inline void waterSpringSolveImplicit(const float* offsets, float* nextOffsets, float* velocities, size_t count, size_t start, size_t end, float stiffness, float damping, float delta) {
+    if (start >= end) return;
+    float coupling = damping * stiffness * delta;
+
+    float upper = 0; // of the previous row, after elimination
+    float right = 0; // same
+    for (size_t i = start; i < end; i++) {
+        float neighbors = (i > 0) + (i + 1 < count);
+        float row = offsets[i] + delta * damping * velocities[i];
+        float diagonal = 1 + coupling * (1 + neighbors);
+        if (i > start) {
+            diagonal += coupling * upper;
+            row += coupling * right;
+        }
+        upper = -coupling / diagonal;
+        right = row / diagonal;
+        velocities[i] = upper;
+        nextOffsets[i] = right;
+    }
+
+    for (size_t i = end - 1; i-- > start;) {
+        nextOffsets[i] -= velocities[i] * nextOffsets[i + 1];
+    }
+    for (size_t i = start; i < end; i++) {
+        velocities[i] = (nextOffsets[i] - offsets[i]) / delta;
+    }
+}
+
+static inline bool waterNodeIsResting(const float* offsets, const float* velocities, size_t i, float restOffset, float restVelocity) {
+    return fabsf(offsets[i]) <= restOffset && fabsf(velocities[i]) <= restVelocity;
+}
+
+// Whether every node in [start, end) is within restOffset of rest and
+// slower than restVelocity.
+static inline bool waterNodesAreResting(const float* offsets, const float* velocities, size_t start, size_t end, float restOffset, float restVelocity) {
+    for (size_t i = start; i < end; i++) {
+        if (!waterNodeIsResting(offsets, velocities, i, restOffset, restVelocity)) return false;
+    }
+    return true;
+}
+
+// Fill sinPhases and cosPhases with the phase 2 pi (x / period - offset) at
+// count nodes spacing apart from firstX, by rotating one phasor from node to
+// node. Done in doubles, the error stays far below a float's after millions
+// of nodes.
+static inline void waterWavePhasors(float* sinPhases, float* cosPhases, size_t count, float firstX, float spacing, float period, float offset) {
+    double phase = WATER_TAU * (firstX / period - offset);
+    double step = WATER_TAU * spacing / period;
+    double sinPhase = sin(phase), cosPhase = cos(phase);
+    double sinStep = sin(step), cosStep = cos(step);
+    for (size_t i = 0; i < count; i++) {
+        sinPhases[i] = sinPhase;
+        cosPhases[i] = cosPhase;
+        double nextSin = sinPhase * cosStep + cosPhase * sinStep;
+        cosPhase = cosPhase * cosStep - sinPhase * sinStep;
+        sinPhase = nextSin;
+    }
+}
+
+// Reference version of waterAddWave. Adds magnitude sin(phase - timePhase)
+// to every offset, with timeSin and timeCos the sin and cos of timePhase.
+static inline void waterAddWaveScalar(float* offsets, const float* sinPhases, const float* cosPhases, size_t count, float magnitude, float timeSin, float timeCos) {
+    float sinScale = magnitude * timeCos;
+    float cosScale = magnitude * timeSin;
+    for (size_t i = 0; i < count; i++) {
+        offsets[i] += sinPhases[i] * sinScale - cosPhases[i] * cosScale;
+    }
+}
+
+// Same output as waterAddWaveScalar, four nodes per step with SSE2.
+static inline void waterAddWave(float* offsets, const float* sinPhases, const float* cosPhases, size_t count, float magnitude, float timeSin, float timeCos) {
+#ifdef __SSE2__
+    float sinScale = magnitude * timeCos;
+    float cosScale = magnitude * timeSin;
+    __m128 sinScale4 = _mm_set1_ps(sinScale);
+    __m128 cosScale4 = _mm_set1_ps(cosScale);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 wave = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(sinPhases + i), sinScale4), _mm_mul_ps(_mm_loadu_ps(cosPhases + i), cosScale4));
+        _mm_storeu_ps(offsets + i, _mm_add_ps(_mm_loadu_ps(offsets + i), wave));
+    }
+    for (; i < count; i++) {
+        offsets[i] += sinPhases[i] * sinScale - cosPhases[i] * cosScale;
+    }
+#else
+    waterAddWaveScalar(offsets, sinPhases, cosPhases, count, magnitude, timeSin, timeCos);
+#endif
+}
+
+#endif // _WATER_SURFACE_H
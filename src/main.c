@@ -1,11 +1,25 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include "raylib.h"
 #include "game.h"
 #include "array.h"
 #include "hash_table.h"
+#include "rng.h"
+#include "file_map.h"
+#include "triple_buffer.h"
+#include "spsc_ring.h"
+#include "jobs.h"
+#include "geometry_batch.h"
+#include "spatial_grid.h"
+#include "water_surface.h"
+#include "particle_pool.h"
 #include "raymath.h"
+#include "rlgl.h"
 
 //#define _CRT_SECURE_NO_WARNINGS
 
@@ -31,10 +45,13 @@
 #define CHUNK_SIZE (Vector2){16, 16}
 #define FPS 60
 #define FIXED_DELTA 1.0/FPS
+#define MAX_TICKS_PER_FRAME 5 // beyond this the game slows down instead of trying to catch up
 #define BOID_CHUNK_MAX 32
+#define SIM_JOB_CHUNK_SIZE 256 // items per stealable job when a system is split up
+#define SCREEN_SIZE (Vector2){800, 800}
+#define COMBO_TEXTURE_SIZE (Vector2){800, 300} // offscreen target of the combo text
+#define WATER_LINE 225.0
 
-bool gameHasStarted = false;
-float comboFlashPercentage = 0.0;
 
 ////////////////////////////////////////////
 // ..Enum
@@ -53,9 +70,71 @@ enum Flag {
     FLAG_CAN_DASH = 8,
 };
 
+enum RngStream {
+    RNG_SPAWN,
+    RNG_PARTICLE,
+    RNG_SHAKE,
+    RNG_PITCH,
+    RNG_STREAM_COUNT,
+};
+
+// Data simulation systems touch, declared to the job graph so it can tell
+// which systems may run at the same time.
+enum SimData {
+    SIM_DATA_BOIDS = 1,
+    SIM_DATA_BOID_MAP = 2,
+    SIM_DATA_BOID_STEERING = 4,
+    SIM_DATA_BOID_BOMBS = 8,
+    SIM_DATA_SNAKE = 16,
+    SIM_DATA_WATER = 32,
+    SIM_DATA_SPLASH_PARTICLES = 64,
+    SIM_DATA_BLOOD_PARTICLES = 128,
+    SIM_DATA_EVENTS = 256,
+    SIM_DATA_RNGS = 512,
+};
+
+typedef enum SoundId {
+    SOUND_HIT_EDGE,
+    SOUND_LEVEL_RESET,
+    SOUND_LEVEL_UP,
+    SOUND_PLANE,
+    SOUND_SPLASH_IN,
+    SOUND_SPLASH_OUT,
+    SOUND_BOMB_EXPLODE,
+    SOUND_EAT,
+    SOUND_EAT2,
+    SOUND_DASH,
+    SOUND_DASH_FAIL,
+    SOUND_CAN_DASH,
+    SOUND_COUNT,
+} SoundId;
+
+typedef enum SimEventType {
+    SIM_EVENT_SOUND,
+    SIM_EVENT_SHAKE,
+    SIM_EVENT_COMBO_FLASH,
+    SIM_EVENT_TYPE_COUNT,
+} SimEventType;
+
+// Side effect requested by the simulation, applied once the tick is over.
+typedef struct SimEvent {
+    SimEventType type;
+    SoundId sound;
+    float volume;
+    float pitch;
+    float strength;
+} SimEvent;
+
+// Region of a texture, usually of SPRITE_ATLAS.
+typedef struct Sprite {
+    Texture2D texture;
+    Rectangle source;
+} Sprite;
+
 typedef struct Entity {
     uint32_t flags;
     Vector2 position;
+    Vector2 previousPosition; // position before the last tick, for render interpolation
     Vector2 velocity;
 } Entity;
 
@@ -93,16 +172,24 @@ typedef struct Snake {
 } Snake;
 
 
-typedef struct WaterNode {
-    Vector2 restingPosition;
-    float forceOffsetY;
-    float naturalOffsetY;
-    float velocityY;
-} WaterNode;
+typedef enum WaterSolver {
+    WATER_SOLVER_EXPLICIT, // waterSpringStep
+    WATER_SOLVER_IMPLICIT, // waterSpringSolveImplicit, stable at any delta and density
+} WaterSolver;
 
+// Nodes are evenly spread over the top of bounds. Every per node value has
+// its own array of floats, see water_surface.h.
 typedef struct WaterBody {
     Rectangle bounds;
-    Array nodes; //WaterNode
+    WaterSolver solver;
+    Array offsets;        // float, y offset from the springs
+    Array nextOffsets;    // float, written by the next step, then swapped with offsets
+    Array velocities;     // float
+    Array awakeSegments;  // bool per WATER_SEGMENT_NODES nodes, the others are exactly at rest
+    // Only filled in render snapshots, by updateWaterWaves.
+    Array naturalOffsets; // float, y offset from the waves
+    Array wavePhasors;    // float, sin then cos of every wave's phase at every node
+    Array phasorWaves;    // WaterWave, the waves wavePhasors was built for
 } WaterBody;
 
 typedef struct WaterWave {
@@ -112,16 +199,6 @@ typedef struct WaterWave {
     float offset;
 } WaterWave;
 
-typedef struct SplashParticle {
-    Entity entity;
-    float radius;
-} SplashParticle;
-
-typedef struct BloodParticle {
-    Entity entity;
-    float lifetime;
-} BloodParticle;
-
 typedef struct BoidBomb {
     Entity entity;
     unsigned int boidCount;
@@ -131,15 +208,29 @@ typedef struct BoidBomb {
 typedef struct World {
     Array boids;
     Array boidBombs;
-    Array splashParticles;
-    Array bloodParticles;
+    ParticlePool splashParticles; // size is the radius
+    ParticlePool bloodParticles;
     BoidMap boidMap;
+    Array boidSteering; //Vector2, velocities computed by boidsReact for boidsMove
     Snake snake;
     Rectangle bounds;
     WaterBody water;
+    Array waves; //WaterWave
+    Array events; //SimEvent, emitted during a tick
     float boidBombSpawnTime;
+    float time;
+    uint64_t seed;
+    Rng rngs[RNG_STREAM_COUNT];
+    FileMap snapshotMap; // backs the arrays of a world loaded from a snapshot
+    bool gameHasStarted;
+    float shakeStrength;
+    Vector2 shakeOffset;
+    float comboFlashPercentage;
 } World;
 
+// Runs startup loading and every simulation system that can be split off the main tick.
+JobSystem jobSystem;
+
 
 ////////////////////////////////////////////
 // ..Color
@@ -149,6 +240,16 @@ Color COLOR_MAIN = WHITE;
 Color COLOR_BG = BLACK;  
 Color COLOR_HIGHLIGHT = RED;
 
+#define COLOR_DARK GetColor(0x171738FF)
+#define COLOR_LIGHT GetColor(0xC1DBE3FF)
+
+// Background and foreground swap once the combo reaches 10.
+void setPalette(float comboLevel) {
+    COLOR_HIGHLIGHT = GetColor(0xBC4B51FF);
+    COLOR_BG = (comboLevel >= 10) ? COLOR_LIGHT : COLOR_DARK;
+    COLOR_MAIN = (comboLevel >= 10) ? COLOR_DARK : COLOR_LIGHT;
+}
+
 // Blend Color
 Color ColorLerp(Color c1, Color c2, float amount) {
     return (Color) {
@@ -237,16 +338,16 @@ float RectangleBottom(Rectangle rect) {
     return rect.y + rect.height;
 }
 
-float RandFloat() {
-    return ((float) rand()) / RAND_MAX;
+float RandFloat(Rng* rng) {
+    return rngFloat(rng);
 }
 
-float RandRange(float range_min, float range_max) {
-    return Lerp(range_min, range_max, RandFloat());
+float RandRange(Rng* rng, float range_min, float range_max) {
+    return Lerp(range_min, range_max, RandFloat(rng));
 }
 
-bool RandBool() {
-    return rand() & 1;
+bool RandBool(Rng* rng) {
+    return rngBool(rng);
 }
 
 float fsign(float num) {
@@ -255,41 +356,107 @@ float fsign(float num) {
     return 0;
 }
 
+// Wall clock seconds, usable without a window (unlike GetTime).
+double getSeconds() {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
 
 
 ////////////////////////////////////////////
 // ..Draw
 ////////////////////////////////////////////
 
+// raylib batches consecutive draws with the same texture into one draw call
+// and flushes the whole batch on every mode change. DrawStats mirrors that
+// so the cost of a frame's draw order can be seen without a GPU profiler.
+typedef struct DrawStats {
+    unsigned int drawCalls;    // this frame
+    unsigned int batchFlushes; // this frame
+    unsigned int textureId;    // texture of the draw call being built, 0 after a flush
+    unsigned long frames;
+    unsigned long totalDrawCalls;
+    unsigned long totalBatchFlushes;
+    unsigned int maxDrawCalls;
+    unsigned int maxBatchFlushes;
+} DrawStats;
+
+DrawStats drawStats = {0};
+
+void countDraw(Texture2D texture) {
+    if (texture.id != drawStats.textureId) {
+        drawStats.drawCalls++;
+        drawStats.textureId = texture.id;
+    }
+}
+
+// Call next to every Begin*Mode/End*Mode and EndDrawing.
+void countBatchFlush() {
+    drawStats.batchFlushes++;
+    drawStats.textureId = 0;
+}
+
+// Circles and lines are queued here and drawn in one instanced draw call by
+// flushGeometry, which anything drawn through raylib has to call first to
+// keep the draw order.
+GeometryBatch geometryBatch = {0};
+
+void flushGeometry();
+
+uint32_t geometryColor(Color color) {
+    uint32_t bits;
+    memcpy(&bits, &color, sizeof(bits));
+    return bits;
+}
+
+void finishDrawStatsFrame() {
+    drawStats.frames++;
+    drawStats.totalDrawCalls += drawStats.drawCalls;
+    drawStats.totalBatchFlushes += drawStats.batchFlushes;
+    drawStats.maxDrawCalls = fmax(drawStats.maxDrawCalls, drawStats.drawCalls);
+    drawStats.maxBatchFlushes = fmax(drawStats.maxBatchFlushes, drawStats.batchFlushes);
+    drawStats.drawCalls = 0;
+    drawStats.batchFlushes = 0;
+}
+
 // Draw anchored
-void DrawSpriteAnchored(Texture2D texture, Vector2 position, float rotation, Vector2 anchor, Color tint) {
-    DrawTexturePro(texture, (Rectangle) { 0, 0, texture.width, texture.height }, 
-                            (Rectangle) { position.x, position.y, texture.width, texture.height },
-                    Vector2Multiply(anchor, (Vector2){ texture.width , texture.height}), rotation, tint
+void DrawSpriteAnchored(Sprite sprite, Vector2 position, float rotation, Vector2 anchor, Color tint) {
+    Rectangle source = sprite.source;
+    flushGeometry();
+    countDraw(sprite.texture);
+    DrawTexturePro(sprite.texture, source, 
+                            (Rectangle) { position.x, position.y, source.width, source.height },
+                    Vector2Multiply(anchor, (Vector2){ source.width , source.height}), rotation, tint
     );
 }
 
-void DrawSpriteAnchoredScaled(Texture2D texture, Vector2 position, float rotation, Vector2 scale, Vector2 anchor, Color tint) {
+void DrawSpriteAnchoredScaled(Sprite sprite, Vector2 position, float rotation, Vector2 scale, Vector2 anchor, Color tint) {
 
     if (scale.x < 0) anchor.x = 1.0 - anchor.x;
     if (scale.y < 0) anchor.y = 1.0 - anchor.y;
 
-    Vector2 origin = Vector2Multiply(anchor, (Vector2) { texture.width*fabs(scale.x), texture.height * fabs(scale.y) });
-    DrawTexturePro(texture, (Rectangle) {0, 0, texture.width * fsign(scale.x), texture.height * fsign(scale.y)},
+    Rectangle source = sprite.source;
+    Vector2 origin = Vector2Multiply(anchor, (Vector2) { source.width*fabs(scale.x), source.height * fabs(scale.y) });
+    flushGeometry();
+    countDraw(sprite.texture);
+    DrawTexturePro(sprite.texture, (Rectangle) {source.x, source.y, source.width * fsign(scale.x), source.height * fsign(scale.y)},
         (Rectangle) {
         position.x, 
         position.y, 
-        texture.width * fabs(scale.x), texture.height  * fabs(scale.y)
+        source.width * fabs(scale.x), source.height  * fabs(scale.y)
     },
         origin, rotation, tint
     );
 }
 
-Vector2 DrawTextAnchored(Vector2 position, Vector2 anchor, Font font, const char* text, int fontSize, float spacing, Color color) {
-    Vector2 textSize = MeasureTextEx(font, text, fontSize, spacing);
+// textSize as measured by MeasureTextEx, usually cached by the caller.
+void DrawTextAnchored(Vector2 position, Vector2 anchor, Vector2 textSize, Font font, const char* text, int fontSize, float spacing, Color color) {
     Vector2 drawPosition = Vector2Subtract(position, Vector2Multiply(textSize, anchor));
+    flushGeometry();
+    countDraw(font.texture);
     DrawTextEx(font, text, drawPosition, fontSize, spacing, color);
-    return textSize;
 }
 
 
@@ -298,12 +465,12 @@ Vector2 DrawTextAnchored(Vector2 position, Vector2 anchor, Font font, const char
 ////////////////////////////////////////////
 
 Camera2D camera = {0};
-float shakeStrength = 0.0;
-Vector2 shakeOffset = {0, 0};
 Vector2 cameraCenter = { 0, 0 };
 
-void shakeCamera(float newIntensity) {
-    shakeStrength = fmaxf(newIntensity, shakeStrength);
+// World rectangle seen through camera. The camera is never rotated.
+Rectangle getCameraView(Camera2D camera, Vector2 screenSize) {
+    Vector2 topLeft = Vector2Subtract(camera.target, Vector2Scale(camera.offset, 1.0 / camera.zoom));
+    return (Rectangle){topLeft.x, topLeft.y, screenSize.x / camera.zoom, screenSize.y / camera.zoom};
 }
 
 
@@ -313,68 +480,365 @@ void shakeCamera(float newIntensity) {
 
 
 
-#define SOUND_INSTANCE_COUNT 1000
+// Every sound gets a fixed group of aliases, created once at load. Playing
+// takes a free alias of the group, so nothing is loaded or unloaded while
+// the game runs. At most SOUND_MAX_REAL_VOICES play at once; past that, or
+// when a group runs out, the new sound steals the least important voice or
+// is dropped if it matters less than all of them.
+//
+// Game code doesn't play sounds directly but requests them. Requests for the
+// same sound are merged per tick, and into the voice of that sound started
+// less than SOUND_COALESCE_WINDOW ago, so a feeding frenzy takes a couple of
+// voices instead of dozens.
+//
+// The voices belong to the audio thread: the simulation only sends it one
+// command per sound and tick through a lock-free ring, so no raylib audio
+// call happens on the simulation thread. Whether that saves it measurable
+// time depends on the audio backend: compare the hand-over time printed at
+// exit against a run with --sync-audio, which keeps the voices on the
+// simulation thread.
+
+#define SOUND_MAX_REAL_VOICES 32
+#define SOUND_MAX_ALIASES 16
+#define SOUND_COALESCE_WINDOW 0.05
+#define SOUND_MAX_COALESCED_VOLUME 1.5
+
+typedef struct SoundVoice {
+    Sound alias;
+    SoundId sound;
+    bool isPlaying;
+    float volume;
+    float priority;
+    double startTime;
+    double endTime;
+} SoundVoice;
+
+typedef struct SoundGroup {
+    SoundVoice voices[SOUND_MAX_ALIASES];
+    unsigned int voiceCount;
+    unsigned int freeVoices[SOUND_MAX_ALIASES]; // stack of indices into voices
+    unsigned int freeCount;
+} SoundGroup;
+
+// Requests for one sound during the current tick.
+typedef struct SoundRequest {
+    float energy;    // sum of squared volumes
+    float volumeSum;
+    float pitchSum;  // weighted by volume
+} SoundRequest;
+
+typedef struct SoundVoiceStats {
+    unsigned long requested;
+    unsigned long merged;  // requests that joined an already playing voice
+    unsigned long played;
+    unsigned long stolen;
+    unsigned long dropped;
+    unsigned long commandsDropped; // the audio thread fell so far behind that its ring was full
+    unsigned long flushes;
+    double flushSeconds;           // time the simulation thread spent handing sounds over
+} SoundVoiceStats;
+
+// Aliases per sound: as many as can usefully overlap.
+const unsigned int SOUND_ALIAS_COUNTS[SOUND_COUNT] = {
+    [SOUND_HIT_EDGE]     = 4,
+    [SOUND_LEVEL_RESET]  = 2,
+    [SOUND_LEVEL_UP]     = 2,
+    [SOUND_PLANE]        = 4,
+    [SOUND_SPLASH_IN]    = 4,
+    [SOUND_SPLASH_OUT]   = 4,
+    [SOUND_BOMB_EXPLODE] = 4,
+    [SOUND_EAT]          = 16,
+    [SOUND_EAT2]         = 16,
+    [SOUND_DASH]         = 2,
+    [SOUND_DASH_FAIL]    = 2,
+    [SOUND_CAN_DASH]     = 2,
+};
+
+// Importance of a sound at full volume when voices run out.
+const float SOUND_PRIORITIES[SOUND_COUNT] = {
+    [SOUND_HIT_EDGE]     = 2.0,
+    [SOUND_LEVEL_RESET]  = 10.0,
+    [SOUND_LEVEL_UP]     = 10.0,
+    [SOUND_PLANE]        = 1.0,
+    [SOUND_SPLASH_IN]    = 3.0,
+    [SOUND_SPLASH_OUT]   = 3.0,
+    [SOUND_BOMB_EXPLODE] = 8.0,
+    [SOUND_EAT]          = 1.5,
+    [SOUND_EAT2]         = 1.0,
+    [SOUND_DASH]         = 6.0,
+    [SOUND_DASH_FAIL]    = 4.0,
+    [SOUND_CAN_DASH]     = 5.0,
+};
 
-Sound soundInstances[SOUND_INSTANCE_COUNT];
+Sound SOUNDS[SOUND_COUNT];
+SoundGroup soundGroups[SOUND_COUNT];
+SoundVoice* activeVoices[SOUND_MAX_REAL_VOICES];
+SoundVoice* lastVoices[SOUND_COUNT]; // voice most recently started per sound
+SoundRequest soundRequests[SOUND_COUNT];
+unsigned int activeVoiceCount = 0;
+SoundVoiceStats soundVoiceStats = {0};
 
 float placeSoundCooldown = 0.0;
 bool isSoundOn = true;
 
-bool playSoundInstance(Sound sound, float volume, float pitch) {
-    static int lastPlayedSoundInt = 0;
-    for (int i = (lastPlayedSoundInt + 1) % SOUND_INSTANCE_COUNT;
-        i != lastPlayedSoundInt; i = (i + 1) % SOUND_INSTANCE_COUNT)
-    {
-        assert(i >= 0);
-        assert(i < SOUND_INSTANCE_COUNT);
-        Sound currentSound = soundInstances[i];
-        if (!IsSoundPlaying(currentSound))
-        {
-            UnloadSoundAlias(currentSound);
-            soundInstances[i] = LoadSoundAlias(sound);
-            SetSoundVolume(soundInstances[i], volume);
-            SetSoundPitch(soundInstances[i], pitch);
-            PlaySound(soundInstances[i]);
-            lastPlayedSoundInt = i;
-            return true;
+void releaseVoice(unsigned int activeIndex) {
+    SoundVoice* voice = activeVoices[activeIndex];
+    SoundGroup* group = &soundGroups[voice->sound];
+    voice->isPlaying = false;
+    group->freeVoices[group->freeCount++] = voice - group->voices;
+    activeVoices[activeIndex] = activeVoices[--activeVoiceCount];
+}
+
+// Voices whose sound is over go back to their group. Bounded by the voice cap.
+void releaseFinishedVoices(double now) {
+    for (unsigned int i = 0; i < activeVoiceCount;) {
+        if (activeVoices[i]->endTime <= now) releaseVoice(i);
+        else i++;
+    }
+}
+
+// Active voice that matters least, only among voices of sound unless sound is SOUND_COUNT.
+int findVictimVoice(SoundId sound) {
+    int victim = -1;
+    for ITERATE(i, activeVoiceCount) {
+        SoundVoice* voice = activeVoices[i];
+        if (sound != SOUND_COUNT && voice->sound != sound) continue;
+        if (victim < 0 || voice->priority < activeVoices[victim]->priority) victim = i;
+    }
+    return victim;
+}
+
+SoundVoice* playSoundInstance(SoundId sound, float volume, float pitch) {
+    if (!isSoundOn) return NULL;
+
+    double now = GetTime();
+    releaseFinishedVoices(now);
+
+    SoundGroup* group = &soundGroups[sound];
+    float priority = SOUND_PRIORITIES[sound] * volume;
+
+    if (!group->freeCount || activeVoiceCount >= SOUND_MAX_REAL_VOICES) {
+        int victim = findVictimVoice(group->freeCount ? SOUND_COUNT : sound);
+        if (victim < 0 || activeVoices[victim]->priority > priority) {
+            soundVoiceStats.dropped++;
+            return NULL;
         }
-        
+        StopSound(activeVoices[victim]->alias);
+        releaseVoice(victim);
+        soundVoiceStats.stolen++;
+    }
+
+    SoundVoice* voice = &group->voices[group->freeVoices[--group->freeCount]];
+    voice->isPlaying = true;
+    voice->volume = volume;
+    voice->priority = priority;
+    voice->startTime = now;
+    voice->endTime = now + (double) SOUNDS[sound].frameCount / (SOUNDS[sound].stream.sampleRate * pitch);
+    activeVoices[activeVoiceCount++] = voice;
+
+    SetSoundVolume(voice->alias, volume);
+    SetSoundPitch(voice->alias, pitch);
+    PlaySound(voice->alias);
+    soundVoiceStats.played++;
+    lastVoices[sound] = voice;
+    return voice;
+}
+
+void requestSound(SoundId sound, float volume, float pitch) {
+    SoundRequest* request = &soundRequests[sound];
+    request->energy += volume * volume;
+    request->volumeSum += volume;
+    request->pitchSum += pitch * volume;
+    soundVoiceStats.requested++;
+}
+
+// Join the voice of sound started within the coalesce window, or start a new one.
+void startCoalescedSound(SoundId sound, float volume, float pitch) {
+    double now = GetTime();
+    SoundVoice* lastVoice = lastVoices[sound];
+    bool canMerge = lastVoice && lastVoice->isPlaying && lastVoice->endTime > now
+        && now - lastVoice->startTime < SOUND_COALESCE_WINDOW;
+
+    if (canMerge) {
+        lastVoice->volume = fminf(sqrtf(lastVoice->volume * lastVoice->volume + volume * volume), SOUND_MAX_COALESCED_VOLUME);
+        lastVoice->priority = SOUND_PRIORITIES[sound] * lastVoice->volume;
+        SetSoundVolume(lastVoice->alias, lastVoice->volume);
+        soundVoiceStats.merged++;
+    } else {
+        playSoundInstance(sound, volume, pitch);
+    }
+}
+
+
+// Alias groups for every sound, once SOUNDS are loaded.
+void createSoundVoices() {
+    for ITERATE(i, SOUND_COUNT) {
+        SoundGroup* group = &soundGroups[i];
+        assert(SOUND_ALIAS_COUNTS[i] <= SOUND_MAX_ALIASES);
+        group->voiceCount = SOUND_ALIAS_COUNTS[i];
+        group->freeCount = 0;
+        for ITERATE(j, group->voiceCount) {
+            group->voices[j].alias = LoadSoundAlias(SOUNDS[i]);
+            group->voices[j].sound = i;
+            group->freeVoices[group->freeCount++] = j;
+        }
+    }
+}
+
+
+#define AUDIO_COMMAND_CAPACITY 256
+
+typedef struct AudioCommand {
+    SoundId sound;
+    float volume;
+    float pitch;
+} AudioCommand;
+
+typedef struct AudioThread {
+    pthread_t thread;
+    SpscRing ring;
+    AudioCommand commands[AUDIO_COMMAND_CAPACITY];
+    sem_t pending; // posted once per committed command, and once to stop
+    _Atomic bool shouldStop;
+    bool isRunning;
+} AudioThread;
+
+// Without a running audio thread (--sync-audio) commands run on the sender.
+AudioThread audioThread = {0};
+
+void sendAudioCommand(AudioThread* audio, AudioCommand command) {
+    if (!audio->isRunning) {
+        startCoalescedSound(command.sound, command.volume, command.pitch);
+        return;
+    }
+
+    uint32_t index;
+    if (!spscReserve(&audio->ring, &index)) {
+        soundVoiceStats.commandsDropped++;
+        return;
+    }
+    audio->commands[index] = command;
+    spscCommit(&audio->ring);
+    sem_post(&audio->pending);
+}
+
+void uploadSounds(); // see ..Assets
+
+void* audioThreadRun(void* data) {
+    AudioThread* audio = data;
+
+    // Sounds aren't needed for the first frame: they are uploaded here while
+    // the game starts. Commands sent meanwhile wait in the ring.
+    uploadSounds();
+
+    // Sleep until a command or the stop request is posted. Commands left
+    // in the ring are still played before stopping.
+    while (true) {
+        while (sem_wait(&audio->pending) != 0) {} // interrupted, wait again
+        uint32_t index;
+        if (spscPeek(&audio->ring, &index)) {
+            AudioCommand command = audio->commands[index];
+            spscRelease(&audio->ring);
+            startCoalescedSound(command.sound, command.volume, command.pitch);
+        } else if (atomic_load(&audio->shouldStop)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+void startAudioThread(AudioThread* audio) {
+    spscInit(&audio->ring, AUDIO_COMMAND_CAPACITY);
+    sem_init(&audio->pending, 0, 0);
+    atomic_init(&audio->shouldStop, false);
+    audio->isRunning = true;
+    pthread_create(&audio->thread, NULL, audioThreadRun, audio);
+}
+
+void stopAudioThread(AudioThread* audio) {
+    if (!audio->isRunning) return;
+    atomic_store(&audio->shouldStop, true);
+    sem_post(&audio->pending);
+    pthread_join(audio->thread, NULL);
+    sem_destroy(&audio->pending);
+    audio->isRunning = false;
+}
+
+// Send the sounds requested since the last flush, one command per sound at
+// most. Volumes add up like energy, pitch is the volume weighted average.
+void flushSoundRequests() {
+    double startTime = getSeconds();
+
+    for ITERATE(i, SOUND_COUNT) {
+        SoundRequest request = soundRequests[i];
+        soundRequests[i] = (SoundRequest){0};
+        if (request.volumeSum <= 0.0) continue;
+
+        AudioCommand command;
+        command.sound = i;
+        command.volume = fminf(sqrtf(request.energy), SOUND_MAX_COALESCED_VOLUME);
+        command.pitch = request.pitchSum / request.volumeSum;
+        sendAudioCommand(&audioThread, command);
     }
-    return false;
+
+    soundVoiceStats.flushes++;
+    soundVoiceStats.flushSeconds += getSeconds() - startTime;
 }
 
 
-Sound HIT_EDGE_SOUND;
-Sound LEVEL_RESET_SOUND;
-Sound LEVEL_UP_SOUND;
-Sound PLANE_SOUND;
-Sound SPLASH_IN_SOUND;
-Sound SPLASH_OUT_SOUND;
-Sound BOMB_EXPLODE_SOUND;
-Sound EAT_SOUND;
-Sound EAT2_SOUND;
-Sound DASH_SOUND;
-Sound DASH_FAIL_SOUND;
-Sound CAN_DASH_SOUND;
+////////////////////////////////////////////
+// ..Event
+////////////////////////////////////////////
+
+// Simulation code never plays sounds or moves the camera itself, it emits
+// events into the tick's event buffer. applySimEvents is the one place they
+// take effect, after the tick, which keeps the simulation free of audio
+// calls and safe to run headless.
+
+void emitSound(Array* events, SoundId sound, float volume, float pitch) {
+    SimEvent event = {SIM_EVENT_SOUND, sound, volume, pitch, 0.0};
+    aAppend(events, &event);
+}
 
+void emitShake(Array* events, float strength) {
+    SimEvent event = {SIM_EVENT_SHAKE, 0, 0.0, 0.0, strength};
+    aAppend(events, &event);
+}
 
-void loadSounds() {
-    HIT_EDGE_SOUND = LoadSound("assets/sounds/hit_edge.wav");
-    LEVEL_RESET_SOUND = LoadSound("assets/sounds/level_reset.wav");
-    LEVEL_UP_SOUND = LoadSound("assets/sounds/level_up.wav");
-    PLANE_SOUND = LoadSound("assets/sounds/plane.wav");
-    SPLASH_IN_SOUND = LoadSound("assets/sounds/splash_in.wav");
-    SPLASH_OUT_SOUND = LoadSound("assets/sounds/splash_out.wav");
-    BOMB_EXPLODE_SOUND = LoadSound("assets/sounds/bomb_explode.wav");
-    EAT_SOUND = LoadSound("assets/sounds/eat.wav");
-    EAT2_SOUND = LoadSound("assets/sounds/eat2.wav");
-    DASH_SOUND = LoadSound("assets/sounds/dash.wav");
-    DASH_FAIL_SOUND = LoadSound("assets/sounds/dash_fail.wav");
-    CAN_DASH_SOUND = LoadSound("assets/sounds/can_dash.wav");
+void emitComboFlash(Array* events) {
+    SimEvent event = {SIM_EVENT_COMBO_FLASH, 0, 0.0, 0.0, 1.0};
+    aAppend(events, &event);
+}
 
-    for ITERATE(i, SOUND_INSTANCE_COUNT) {
-        soundInstances[i] = LoadSoundAlias(EAT_SOUND);
+// Where applySimEvents sends events. A headless sink only counts them.
+typedef struct EventSink {
+    bool isHeadless;
+    unsigned long counts[SIM_EVENT_TYPE_COUNT];
+} EventSink;
+
+void applySimEvents(World* world, EventSink* sink) {
+    for ITERATE(i, world->events.used) {
+        SimEvent* event = aGet(&world->events, i);
+        sink->counts[event->type]++;
+        if (sink->isHeadless) continue;
+
+        switch (event->type) {
+            case SIM_EVENT_SOUND:
+                requestSound(event->sound, event->volume, event->pitch);
+                break;
+            case SIM_EVENT_SHAKE:
+                world->shakeStrength = fmaxf(event->strength, world->shakeStrength);
+                break;
+            case SIM_EVENT_COMBO_FLASH:
+                world->comboFlashPercentage = event->strength;
+                break;
+            default:
+                assert(false);
+        }
     }
+
+    world->events.used = 0;
+    if (!sink->isHeadless) flushSoundRequests();
 }
 
 
@@ -383,29 +847,26 @@ void loadSounds() {
 // ..Sprites
 ////////////////////////////////////////////
 
-Texture2D PLANE_SPRITE;
-Texture2D MANDIBLE_SPRITE;
-Texture2D STRING_SPRITE;
-Texture2D FISH_ICON_SPRITE;
-Image FISH_WINDOW_ICON;
+#define SPRITE_ATLAS_MAX_WIDTH 1024
+#define SPRITE_ATLAS_PADDING 2
+#define SPRITE_ATLAS_WHITE_SIZE 4 // white square the shapes are drawn with
 
-void loadSprites() {
-    PLANE_SPRITE        = LoadTexture("assets/sprites/plane.png");
-    MANDIBLE_SPRITE     = LoadTexture("assets/sprites/mandible.png");
-    STRING_SPRITE       = LoadTexture("assets/sprites/string.png");
-    FISH_ICON_SPRITE    = LoadTexture("assets/sprites/fish_icon.png");
-    FISH_WINDOW_ICON    = LoadImage("assets/sprites/fish_window_icon.png");
-}
+// Every sprite lives in this one texture, which is also the shapes texture.
+Texture2D SPRITE_ATLAS;
+Image SPRITE_ATLAS_IMAGE; // its pixels, only kept for the software renderer
+
+Sprite PLANE_SPRITE;
+Sprite MANDIBLE_SPRITE;
+Sprite STRING_SPRITE;
+Sprite FISH_ICON_SPRITE;
+Image FISH_WINDOW_ICON;
 
 ////////////////////////////////////////////
 // ..Fonts
 ////////////////////////////////////////////
 
 Font MAIN_FONT;
-
-void loadFonts() {
-    MAIN_FONT           = LoadFontEx("assets/fonts/Concert_One/ConcertOne-Regular.ttf", 400, NULL, 0);
-}
+Image MAIN_FONT_IMAGE; // RGBA copy of its atlas, only kept for the software renderer
 
 ////////////////////////////////////////////
 // ..Shaders
@@ -429,294 +890,1511 @@ GLSLColor glslColor(Color color) {
 
 Shader MASK_SHADER;
 
-void loadShaders() {
-    MASK_SHADER           = LoadShader(0, TextFormat("assets/shaders/mask.fs", GLSL_VERSION));
-}
+typedef struct MaskShaderLocations {
+    int cutoff;
+    int color1;
+    int color2;
+} MaskShaderLocations;
+
+MaskShaderLocations maskShaderLocations;
+Shader CAPSULE_SHADER; // GeometryBatch instances
 
 
 ////////////////////////////////////////////
-// ..Entity
+// ..Geometry
 ////////////////////////////////////////////
 
-#define GRAVITY 600
+// geometryBatch is uploaded into one growing instance buffer and drawn as
+// instanced quads with CAPSULE_SHADER: six corner vertices shared by every
+// instance, one GeometryInstance per quad.
+
+#define GEOMETRY_INITIAL_CAPACITY 4096
+
+typedef struct GeometryRenderer {
+    unsigned int vertexArray;
+    unsigned int cornerBuffer;
+    unsigned int instanceBuffer;
+    size_t instanceCapacity;
+} GeometryRenderer;
+
+GeometryRenderer geometryRenderer = {0};
+
+void bindGeometryInstanceAttributes() {
+    int segmentLocation = GetShaderLocationAttrib(CAPSULE_SHADER, "instanceSegment");
+    int radiusLocation = GetShaderLocationAttrib(CAPSULE_SHADER, "instanceRadius");
+    int colorLocation = GetShaderLocationAttrib(CAPSULE_SHADER, "vertexColor");
+
+    rlSetVertexAttribute(segmentLocation, 4, RL_FLOAT, false, sizeof(GeometryInstance), (void*) offsetof(GeometryInstance, x));
+    rlSetVertexAttribute(radiusLocation, 1, RL_FLOAT, false, sizeof(GeometryInstance), (void*) offsetof(GeometryInstance, radius));
+    rlSetVertexAttribute(colorLocation, 4, RL_UNSIGNED_BYTE, true, sizeof(GeometryInstance), (void*) offsetof(GeometryInstance, color));
+    rlSetVertexAttributeDivisor(segmentLocation, 1);
+    rlSetVertexAttributeDivisor(radiusLocation, 1);
+    rlSetVertexAttributeDivisor(colorLocation, 1);
+    rlEnableVertexAttribute(segmentLocation);
+    rlEnableVertexAttribute(radiusLocation);
+    rlEnableVertexAttribute(colorLocation);
+}
 
-void clearDeadEntities(Array* entities) {
-    size_t aliveBoidCount = 0;
-    for ITERATE(i, entities->used) {
-        Entity* entity = aGet(entities, i);
-        bool isDead = (entity->flags & FLAG_DEAD) != 0;
+// Needs CAPSULE_SHADER, so after loadAssets.
+void initGeometryRenderer() {
+    const float corners[] = { -1, -1,  1, -1,  1, 1,  -1, -1,  1, 1,  -1, 1 };
+    GeometryRenderer* renderer = &geometryRenderer;
+    geometryBatchInit(&geometryBatch, GEOMETRY_INITIAL_CAPACITY);
 
-        if (!isDead)
-            aSet(entities, aliveBoidCount, entity);
+    renderer->vertexArray = rlLoadVertexArray();
+    rlEnableVertexArray(renderer->vertexArray);
 
-        aliveBoidCount += !isDead;
+    renderer->cornerBuffer = rlLoadVertexBuffer(corners, sizeof(corners), false);
+    int cornerLocation = GetShaderLocationAttrib(CAPSULE_SHADER, "vertexPosition");
+    rlSetVertexAttribute(cornerLocation, 2, RL_FLOAT, false, 0, 0);
+    rlEnableVertexAttribute(cornerLocation);
+
+    renderer->instanceCapacity = GEOMETRY_INITIAL_CAPACITY;
+    renderer->instanceBuffer = rlLoadVertexBuffer(NULL, renderer->instanceCapacity * sizeof(GeometryInstance), true);
+    bindGeometryInstanceAttributes();
+
+    rlDisableVertexArray();
+}
+
+void cleanGeometryRenderer() {
+    rlUnloadVertexBuffer(geometryRenderer.instanceBuffer);
+    rlUnloadVertexBuffer(geometryRenderer.cornerBuffer);
+    rlUnloadVertexArray(geometryRenderer.vertexArray);
+    geometryBatchFree(&geometryBatch);
+}
+
+// Draw everything queued in geometryBatch with the current camera, then
+// clear it.
+void flushGeometry() {
+    GeometryRenderer* renderer = &geometryRenderer;
+    if (geometryBatch.count == 0) return;
+
+    // Whatever raylib has batched so far goes first.
+    rlDrawRenderBatchActive();
+    countBatchFlush();
+    drawStats.drawCalls++;
+
+    rlEnableVertexArray(renderer->vertexArray);
+    if (geometryBatch.count > renderer->instanceCapacity) {
+        while (renderer->instanceCapacity < geometryBatch.count) renderer->instanceCapacity *= 2;
+        rlUnloadVertexBuffer(renderer->instanceBuffer);
+        renderer->instanceBuffer = rlLoadVertexBuffer(NULL, renderer->instanceCapacity * sizeof(GeometryInstance), true);
+        bindGeometryInstanceAttributes();
     }
+    rlUpdateVertexBuffer(renderer->instanceBuffer, geometryBatch.instances, geometryBatch.count * sizeof(GeometryInstance), 0);
 
-    entities->used = aliveBoidCount;
+    rlEnableShader(CAPSULE_SHADER.id);
+    Matrix modelViewProjection = MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection());
+    rlSetUniformMatrix(CAPSULE_SHADER.locs[SHADER_LOC_MATRIX_MVP], modelViewProjection);
+    rlDrawVertexArrayInstanced(0, 6, geometryBatch.count);
+    rlDisableShader();
+    rlDisableVertexArray();
+
+    geometryBatchClear(&geometryBatch);
 }
 
+
 ////////////////////////////////////////////
-// ..Water
+// ..Render
 ////////////////////////////////////////////
 
-#define WATER_SPRING_CONSTANT 150
-#define WATER_DAMPENING 0.020
+// Render systems don't draw, they record RenderCommands into their own
+// RenderList, so they can run on any thread. The lists are merged and sorted
+// by target, layer and state (shader, then texture) and replayed on the main
+// thread with executeRenderQueue. Commands with the same key keep the order
+// they were recorded in, so only put things in the same layer when they may
+// be drawn in any order relative to other states.
+
+#define RENDER_TEXT_MAX 24
+
+typedef enum RenderTarget {
+    RENDER_TARGET_COMBO,  // offscreen, drawn to the screen by the HUD
+    RENDER_TARGET_SCREEN, // with the camera
+    RENDER_TARGET_COUNT,
+} RenderTarget;
+
+// Back to front.
+typedef enum RenderLayer {
+    LAYER_COMBO,
+    LAYER_HUD,
+    LAYER_BLOOD,
+    LAYER_BOIDS,
+    LAYER_WATER,
+    LAYER_BOMB_PLANES,  // planes and strings, behind the bombs
+    LAYER_BOMBS,
+    LAYER_BOMB_ICONS,
+    LAYER_SNAKE,
+    LAYER_SNAKE_MANDIBLES,
+    LAYER_SPLASH,
+} RenderLayer;
+
+typedef enum RenderPrimitive {
+    RENDER_GEOMETRY,        // range of a GeometryBatch
+    RENDER_SPRITE,
+    RENDER_TEXT,
+    RENDER_MASKED_TEXTURE,  // texture through MASK_SHADER
+} RenderPrimitive;
+
+typedef struct RenderCommand {
+    RenderTarget target;
+    RenderLayer layer;
+    RenderPrimitive primitive;
+    unsigned int shaderId;  // 0 for the default shader
+    unsigned int textureId;
+    union {
+        struct {
+            GeometryBatch* batch;
+            size_t first;
+            size_t count;
+        } geometry;
+        struct {
+            Sprite sprite;
+            Vector2 position;
+            float rotation;
+            Vector2 scale;
+            Vector2 anchor;
+            Color tint;
+        } sprite;
+        struct {
+            Font* font;
+            char text[RENDER_TEXT_MAX];
+            Vector2 size;
+            Vector2 position;
+            Vector2 anchor;
+            int fontSize;
+            float spacing;
+            Color color;
+        } text;
+        struct {
+            Texture2D texture;
+            Rectangle source;
+            Vector2 position;
+            float cutoff;
+            GLSLColor color1;
+            GLSLColor color2;
+        } masked;
+    };
+} RenderCommand;
 
-void initWaterBody(WaterBody* water, Rectangle bounds, float nodesPerDistance) {
+typedef struct RenderList {
+    Array commands;          // RenderCommand
+    GeometryBatch geometry;  // instances of this list's RENDER_GEOMETRY commands
+} RenderList;
 
-    unsigned int nodeCount = ceil(bounds.width * nodesPerDistance);
-    assert(nodeCount > 1);
+void initRenderList(RenderList* list) {
+    list->commands = aCreate(64, sizeof(RenderCommand));
+    geometryBatchInit(&list->geometry, 256);
+}
 
-    water->nodes = aCreate(nodeCount, sizeof(WaterNode));
-    water->nodes.used = water->nodes.size;
-    water->bounds = bounds;
+void cleanRenderList(RenderList* list) {
+    aFree(&list->commands);
+    geometryBatchFree(&list->geometry);
+}
+
+void clearRenderList(RenderList* list) {
+    list->commands.used = 0;
+    geometryBatchClear(&list->geometry);
+}
 
-    Vector2 boundsTopLeft = RectangleTopLeft(bounds);
+RenderCommand* recordCommand(RenderList* list, RenderTarget target, RenderLayer layer, RenderPrimitive primitive, unsigned int shaderId, unsigned int textureId) {
+    RenderCommand command = {target, layer, primitive, shaderId, textureId};
+    aAppend(&list->commands, &command);
+    return aGet(&list->commands, list->commands.used - 1);
+}
 
-    for ITERATE(i, water->nodes.used) {
-        WaterNode* waterNode = aGet(&water->nodes, i);
-        waterNode->restingPosition = Vector2Add(boundsTopLeft, (Vector2){bounds.width * ((float) i) / (water->nodes.used - 1), 0});
-        waterNode->velocityY = 0;
-        waterNode->forceOffsetY = 0;
-        waterNode->naturalOffsetY = 0;
+// Call after adding instances to list->geometry. Extends the previous command
+// when it's geometry on the same layer, so a system's shapes stay one command.
+void recordGeometry(RenderList* list, RenderLayer layer, size_t first) {
+    size_t count = list->geometry.count - first;
+    if (count == 0) return;
+
+    if (list->commands.used > 0) {
+        RenderCommand* last = aGet(&list->commands, list->commands.used - 1);
+        if (last->primitive == RENDER_GEOMETRY && last->layer == layer && last->target == RENDER_TARGET_SCREEN
+            && last->geometry.first + last->geometry.count == first) {
+            last->geometry.count += count;
+            return;
+        }
     }
+
+    RenderCommand* command = recordCommand(list, RENDER_TARGET_SCREEN, layer, RENDER_GEOMETRY, CAPSULE_SHADER.id, 0);
+    command->geometry.batch = &list->geometry;
+    command->geometry.first = first;
+    command->geometry.count = count;
 }
 
-void cleanWaterBody(WaterBody* water) {
-    aFree(&water->nodes);
+void recordCircle(RenderList* list, RenderLayer layer, Vector2 position, float radius, Color color) {
+    size_t first = list->geometry.count;
+    geometryBatchAddCircle(&list->geometry, position.x, position.y, radius, geometryColor(color));
+    recordGeometry(list, layer, first);
 }
 
+// Line with round caps.
+void recordCapsule(RenderList* list, RenderLayer layer, Vector2 start, Vector2 end, float radius, Color color) {
+    size_t first = list->geometry.count;
+    geometryBatchAddCapsule(&list->geometry, start.x, start.y, end.x, end.y, radius, geometryColor(color));
+    recordGeometry(list, layer, first);
+}
 
-Vector2 getWaterNodePosition(WaterNode* waterNode) {
-    return Vector2Add(waterNode->restingPosition, (Vector2){0, waterNode->forceOffsetY + waterNode->naturalOffsetY});
+void recordCircles(RenderList* list, RenderLayer layer, const GeometryCircles* circles) {
+    size_t first = list->geometry.count;
+    geometryBatchAddCircles(&list->geometry, circles);
+    recordGeometry(list, layer, first);
 }
 
-Vector2 getWaterNodeForcedPosition(WaterNode* waterNode) {
-    return Vector2Add(waterNode->restingPosition, (Vector2){0, waterNode->forceOffsetY});
+void recordSprite(RenderList* list, RenderLayer layer, Sprite sprite, Vector2 position, float rotation, Vector2 scale, Vector2 anchor, Color tint) {
+    RenderCommand* command = recordCommand(list, RENDER_TARGET_SCREEN, layer, RENDER_SPRITE, 0, sprite.texture.id);
+    command->sprite.sprite = sprite;
+    command->sprite.position = position;
+    command->sprite.rotation = rotation;
+    command->sprite.scale = scale;
+    command->sprite.anchor = anchor;
+    command->sprite.tint = tint;
 }
 
+// Text measured once, until its string or size changes.
+typedef struct CachedText {
+    Font* font;
+    char text[RENDER_TEXT_MAX];
+    int fontSize;
+    float spacing;
+    Vector2 size;
+} CachedText;
+
+// Returns true when the text changed, and measures it again.
+bool updateCachedText(CachedText* cached, Font* font, const char* text, int fontSize, float spacing) {
+    assert(strlen(text) < RENDER_TEXT_MAX);
+    bool isChanged = cached->font != font || cached->fontSize != fontSize || cached->spacing != spacing
+        || strcmp(cached->text, text) != 0;
+    if (isChanged) {
+        cached->font = font;
+        strcpy(cached->text, text);
+        cached->fontSize = fontSize;
+        cached->spacing = spacing;
+        cached->size = MeasureTextEx(*font, text, fontSize, spacing);
+    }
+    return isChanged;
+}
 
-float waveAt(WaterWave* wave, float x, float t) {
-    return wave->magnitude * sin(-wave->speed * t + 2 * PI * (x / wave->period - wave->offset));
+void recordText(RenderList* list, RenderTarget target, RenderLayer layer, Vector2 position, Vector2 anchor, CachedText* text, Color color) {
+    RenderCommand* command = recordCommand(list, target, layer, RENDER_TEXT, 0, text->font->texture.id);
+    command->text.font = text->font;
+    strcpy(command->text.text, text->text);
+    command->text.size = text->size;
+    command->text.position = position;
+    command->text.anchor = anchor;
+    command->text.fontSize = text->fontSize;
+    command->text.spacing = text->spacing;
+    command->text.color = color;
 }
 
-void waterBodyUpdate(WaterBody* water, float delta) {
-    
-    for ITERATE(i, water->nodes.used) {
-        WaterNode* waterNode = aGet(&water->nodes, i);
-        waterNode->velocityY -= WATER_SPRING_CONSTANT * waterNode->forceOffsetY * delta;
-        
-        Vector2 referencePosition = getWaterNodeForcedPosition(waterNode);
+// Boids and particles are copied into the render snapshot sorted by grid
+// cell (see spatial_grid.h), so render systems only visit the cells that
+// overlap the view, plus a margin for radius and interpolation.
+#define RENDER_GRID_CELL_SIZE 64
+#define RENDER_CULL_MARGIN 32
+
+typedef struct CullStats {
+    unsigned long drawn;
+    unsigned long culled;
+} CullStats;
+
+SpatialGridRange getVisibleCells(SpatialGrid* grid, Rectangle view) {
+    return spatialGridQuery(grid,
+        view.x - RENDER_CULL_MARGIN, view.y - RENDER_CULL_MARGIN,
+        view.x + view.width + RENDER_CULL_MARGIN, view.y + view.height + RENDER_CULL_MARGIN);
+}
 
-        int connectedNodes[] = {i - 1, i + 1};
+void countCulling(CullStats* stats, size_t drawn, size_t total) {
+    stats->drawn += drawn;
+    stats->culled += total - drawn;
+}
 
-        for ITERATE(ji, 2) {
-            int j = connectedNodes[ji];
+// Uniforms are per command, the mask is set up again for each one.
+void recordMaskedTexture(RenderList* list, RenderLayer layer, Texture2D texture, Rectangle source, Vector2 position, float cutoff, GLSLColor color1, GLSLColor color2) {
+    RenderCommand* command = recordCommand(list, RENDER_TARGET_SCREEN, layer, RENDER_MASKED_TEXTURE, MASK_SHADER.id, texture.id);
+    command->masked.texture = texture;
+    command->masked.source = source;
+    command->masked.position = position;
+    command->masked.cutoff = cutoff;
+    command->masked.color1 = color1;
+    command->masked.color2 = color2;
+}
 
-            if (aHas(&water->nodes, j)) {
-                WaterNode* otherNode = aGet(&water->nodes, j);
-                Vector2 displacement = Vector2Subtract(getWaterNodeForcedPosition(otherNode), referencePosition);
-                waterNode->velocityY += WATER_SPRING_CONSTANT * displacement.y  * delta;
-            }
-        }
 
-        waterNode->velocityY *= pow(WATER_DAMPENING, delta);
-        
-    }
+// Sort key, most significant first: target 4 bits, layer 8, shader 8,
+// texture 20, then the position in the recorded lists, 24 bits.
+#define RENDER_SEQUENCE_BITS 24
 
-    
-}
+typedef struct RenderQueueEntry {
+    uint64_t key;
+    RenderCommand* command;
+} RenderQueueEntry;
 
-void waterBodyMove(WaterBody* water, Array* waves, float time, float delta) {
+typedef struct RenderQueue {
+    Array entries; // RenderQueueEntry
+} RenderQueue;
 
-    for ITERATE(i, water->nodes.used) {
-        WaterNode* waterNode = aGet(&water->nodes, i);
-        waterNode->forceOffsetY += waterNode->velocityY * delta;
+uint64_t getRenderCommandKey(RenderCommand* command, uint32_t sequence) {
+    assert(sequence < (1u << RENDER_SEQUENCE_BITS));
+    return ((uint64_t) command->target << 60)
+        | ((uint64_t) command->layer << 52)
+        | ((uint64_t) (command->shaderId & 0xFF) << 44)
+        | ((uint64_t) (command->textureId & 0xFFFFF) << RENDER_SEQUENCE_BITS)
+        | sequence;
+}
 
-        waterNode->naturalOffsetY = 0.0;
+int compareRenderQueueEntries(const void* a, const void* b) {
+    uint64_t keyA = ((const RenderQueueEntry*) a)->key;
+    uint64_t keyB = ((const RenderQueueEntry*) b)->key;
+    return (keyA > keyB) - (keyA < keyB);
+}
 
-        for ITERATE(j, waves->used) {
-            WaterWave* wave = aGet(waves, j);
-            waterNode->naturalOffsetY += waveAt(wave, waterNode->restingPosition.x, time);
+// Merge the lists in order and sort them. The lists must outlive the queue.
+void buildRenderQueue(RenderQueue* queue, RenderList* lists, size_t listCount) {
+    queue->entries.used = 0;
+    uint32_t sequence = 0;
+    for ITERATE(i, listCount) {
+        for ITERATE(j, lists[i].commands.used) {
+            RenderCommand* command = aGet(&lists[i].commands, j);
+            RenderQueueEntry entry = {getRenderCommandKey(command, sequence++), command};
+            aAppend(&queue->entries, &entry);
         }
     }
+    qsort(queue->entries.array, queue->entries.used, sizeof(RenderQueueEntry), compareRenderQueueEntries);
 }
 
-void waterBodyRender(WaterBody* water) {
-
-    Array splinePositions = aCreate(water->nodes.used, sizeof(Vector2));
-    splinePositions.used = splinePositions.size;
+void beginRenderTarget(RenderTarget target, RenderTexture2D comboTexture, Camera2D camera) {
+    switch (target) {
+        case RENDER_TARGET_COMBO:
+            BeginTextureMode(comboTexture);
+            ClearBackground((Color){0});
+            break;
+        case RENDER_TARGET_SCREEN:
+            BeginMode2D(camera);
+            break;
+        default:
+            assert(false);
+    }
+}
 
-    for ITERATE(i, water->nodes.used) {
-        WaterNode* waterNode = aGet(&water->nodes, i);
-        Vector2 position = getWaterNodePosition(waterNode);
-        aSet(&splinePositions, i, &position);
+void endRenderTarget(RenderTarget target) {
+    flushGeometry();
+    switch (target) {
+        case RENDER_TARGET_COMBO:   EndTextureMode(); break;
+        case RENDER_TARGET_SCREEN:  EndMode2D(); break;
+        default:                    assert(false);
     }
+    countBatchFlush();
+}
 
-    DrawSplineLinear(splinePositions.array, splinePositions.used, 5, COLOR_MAIN);
-    aFree(&splinePositions);
+void drawMaskedTexture(RenderCommand* command) {
+    flushGeometry();
+    BeginShaderMode(MASK_SHADER); {
+        SetShaderValue(MASK_SHADER, maskShaderLocations.cutoff, &command->masked.cutoff, SHADER_UNIFORM_FLOAT);
+        SetShaderValue(MASK_SHADER, maskShaderLocations.color1, &command->masked.color1, SHADER_UNIFORM_VEC4);
+        SetShaderValue(MASK_SHADER, maskShaderLocations.color2, &command->masked.color2, SHADER_UNIFORM_VEC4);
+        countDraw(command->masked.texture);
+        DrawTextureRec(command->masked.texture, command->masked.source, command->masked.position, WHITE);
+    } EndShaderMode();
+    countBatchFlush();
 }
 
-WaterNode* getNearestWaterNode(WaterBody* water, Vector2 position) {
+// Draw the sorted commands, only switching targets and modes when the state
+// changes. Consecutive geometry goes out in one flushGeometry.
+void executeRenderQueue(RenderQueue* queue, RenderTexture2D comboTexture, Camera2D camera) {
+    RenderTarget target = RENDER_TARGET_COUNT;
+
+    for ITERATE(i, queue->entries.used) {
+        RenderCommand* command = ((RenderQueueEntry*) aGet(&queue->entries, i))->command;
+        if (command->target != target) {
+            if (target != RENDER_TARGET_COUNT) endRenderTarget(target);
+            target = command->target;
+            beginRenderTarget(target, comboTexture, camera);
+        }
 
-    int nodeId = position.x / water->bounds.width * water->nodes.used;
-    nodeId = Clamp(nodeId, 0, water->nodes.used - 1);
-    WaterNode* waterNode = aGet(&water->nodes, nodeId);
-    return waterNode;
-}
+        switch (command->primitive) {
+            case RENDER_GEOMETRY: {
+                GeometryBatch* batch = command->geometry.batch;
+                geometryBatchReserve(&geometryBatch, command->geometry.count);
+                memcpy(&geometryBatch.instances[geometryBatch.count], &batch->instances[command->geometry.first],
+                    command->geometry.count * sizeof(GeometryInstance));
+                geometryBatch.count += command->geometry.count;
+                break;
+            }
+            case RENDER_SPRITE:
+                DrawSpriteAnchoredScaled(command->sprite.sprite, command->sprite.position, command->sprite.rotation,
+                    command->sprite.scale, command->sprite.anchor, command->sprite.tint);
+                break;
+            case RENDER_TEXT:
+                DrawTextAnchored(command->text.position, command->text.anchor, command->text.size, *command->text.font, command->text.text,
+                    command->text.fontSize, command->text.spacing, command->text.color);
+                break;
+            case RENDER_MASKED_TEXTURE:
+                drawMaskedTexture(command);
+                break;
+        }
+    }
 
-bool inWater(WaterBody* water, Vector2 position) {
-    return CheckCollisionPointRec(position, water->bounds);
+    if (target != RENDER_TARGET_COUNT) endRenderTarget(target);
 }
 
 
 ////////////////////////////////////////////
-// ..SplashParticle
+// ..Assets
 ////////////////////////////////////////////
 
-void spawnSpawnParticles(Array* splashParticles, Vector2 position, float speed, unsigned int count) {
-    for ITERATE(i, count) {
-        SplashParticle splashParticle = {0};
-        splashParticle.entity.position = position;
-        splashParticle.radius = RandRange(1, 6);
-        splashParticle.entity.velocity = Vector2Scale(Vector2Rotate((Vector2){0, -1}, RandRange(-PI / 4, PI / 4)), speed * RandRange(0.8, 1.0) / sqrt(splashParticle.radius));
-        splashParticle.entity.flags = FLAG_SPAWNING;
-        aAppend(splashParticles, &splashParticle);
+// Files are read and decoded in parallel on the job system, only the GPU
+// uploads stay on the main thread. The font is rasterized in chunks of
+// glyphs. Sounds aren't needed for the first frame, so they are decoded with
+// everything else but uploaded later by the audio thread.
+//
+// When ASSET_PACK_PATH exists (built with --pack), assets come out of it
+// already decoded: pixels as RGBA, sounds as PCM, the rest as raw bytes. The
+// pack is mapped, and images, waves and texts point straight into it, so a
+// packed asset costs no open, read or decode. Assets missing from the pack
+// are loaded from their own file.
+//
+// Rasterizing the font is the slowest step, so the finished atlas and glyph
+// metrics are cached next to the font file (FONT_CACHE_EXTENSION), keyed by
+// font path, size and charset. A cache with a different key is ignored and
+// rewritten.
+
+#define FONT_GLYPH_PADDING 4    // same as LoadFontEx
+#define FONT_FIRST_CODEPOINT 32
+#define FONT_GLYPH_COUNT 95     // printable ASCII, the LoadFontEx default
+#define FONT_GLYPHS_PER_JOB 8
+
+#define FONT_CACHE_EXTENSION ".atlas"
+#define FONT_CACHE_MAGIC 0x464D4F4E // "NOMF"
+#define FONT_CACHE_VERSION 1
+
+#define ASSET_PACK_PATH "assets/assets.pack"
+#define ASSET_PACK_MAGIC 0x414D4F4E // "NOMA"
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_ALIGNMENT 16
+#define ASSET_PACK_PATH_MAX 64
+
+typedef enum AssetType {
+    ASSET_SPRITE, // packed into SPRITE_ATLAS
+    ASSET_IMAGE,  // stays on the CPU
+    ASSET_VERTEX_SHADER, // linked with the ASSET_SHADER right after it
+    ASSET_SHADER, // fragment shader
+    ASSET_SOUND,  // uploaded by uploadSounds
+    ASSET_FONT,   // font file, only as a pack entry
+} AssetType;
+
+typedef struct Asset {
+    const char* path;
+    AssetType type;
+    void* target; // Sprite, Image, Shader or Sound to load
+    Image image;
+    Wave wave;
+    char* text;
+    bool isPacked; // data points into the asset pack, nothing to unload
+    Rectangle atlasSource; // sprites: where the sprite went in SPRITE_ATLAS
+    double decodeSeconds;
+    double uploadSeconds;
+} Asset;
+
+typedef struct FontLoad {
+    const char* path;
+    int size;
+    Font* target;
+    unsigned char* fileData;
+    int fileSize;
+    bool isPacked;
+    char cachePath[ASSET_PACK_PATH_MAX + sizeof(FONT_CACHE_EXTENSION)];
+    FileMap cacheMap; // open while the atlas points into it
+    bool isCached;
+    GlyphInfo* glyphs;
+    Rectangle* recs;
+    Image atlas;
+    double chunkSeconds[(FONT_GLYPH_COUNT + FONT_GLYPHS_PER_JOB - 1) / FONT_GLYPHS_PER_JOB];
+    double decodeSeconds;
+    double uploadSeconds;
+} FontLoad;
+
+enum AssetData {
+    ASSET_DATA_FILES = 1,
+    ASSET_DATA_FONT_FILE = 2,
+    ASSET_DATA_FONT_GLYPHS = 4,
+    ASSET_DATA_FONT_ATLAS = 8,
+    ASSET_DATA_FONT_CACHE = 16,
+    ASSET_DATA_SPRITE_ATLAS = 32,
+};
+
+Asset ASSETS[] = {
+    {"assets/sprites/plane.png",            ASSET_SPRITE,  &PLANE_SPRITE},
+    {"assets/sprites/mandible.png",         ASSET_SPRITE,  &MANDIBLE_SPRITE},
+    {"assets/sprites/string.png",           ASSET_SPRITE,  &STRING_SPRITE},
+    {"assets/sprites/fish_icon.png",        ASSET_SPRITE,  &FISH_ICON_SPRITE},
+    {"assets/sprites/fish_window_icon.png", ASSET_IMAGE,    &FISH_WINDOW_ICON},
+    {"assets/shaders/mask.fs",              ASSET_SHADER,   &MASK_SHADER},
+    {"assets/shaders/capsule.vs",           ASSET_VERTEX_SHADER, &CAPSULE_SHADER},
+    {"assets/shaders/capsule.fs",           ASSET_SHADER,   &CAPSULE_SHADER},
+    {"assets/sounds/hit_edge.wav",          ASSET_SOUND,    &SOUNDS[SOUND_HIT_EDGE]},
+    {"assets/sounds/level_reset.wav",       ASSET_SOUND,    &SOUNDS[SOUND_LEVEL_RESET]},
+    {"assets/sounds/level_up.wav",          ASSET_SOUND,    &SOUNDS[SOUND_LEVEL_UP]},
+    {"assets/sounds/plane.wav",             ASSET_SOUND,    &SOUNDS[SOUND_PLANE]},
+    {"assets/sounds/splash_in.wav",         ASSET_SOUND,    &SOUNDS[SOUND_SPLASH_IN]},
+    {"assets/sounds/splash_out.wav",        ASSET_SOUND,    &SOUNDS[SOUND_SPLASH_OUT]},
+    {"assets/sounds/bomb_explode.wav",      ASSET_SOUND,    &SOUNDS[SOUND_BOMB_EXPLODE]},
+    {"assets/sounds/eat.wav",               ASSET_SOUND,    &SOUNDS[SOUND_EAT]},
+    {"assets/sounds/eat2.wav",              ASSET_SOUND,    &SOUNDS[SOUND_EAT2]},
+    {"assets/sounds/dash.wav",              ASSET_SOUND,    &SOUNDS[SOUND_DASH]},
+    {"assets/sounds/dash_fail.wav",         ASSET_SOUND,    &SOUNDS[SOUND_DASH_FAIL]},
+    {"assets/sounds/can_dash.wav",          ASSET_SOUND,    &SOUNDS[SOUND_CAN_DASH]},
+};
+
+#define ASSET_COUNT (sizeof(ASSETS) / sizeof(ASSETS[0]))
+
+FontLoad mainFontLoad = {"assets/fonts/Concert_One/ConcertOne-Regular.ttf", 400, &MAIN_FONT};
+
+typedef struct AssetPackEntry {
+    char path[ASSET_PACK_PATH_MAX];
+    uint32_t type;       // AssetType
+    uint32_t width;      // images: RGBA8 pixels
+    uint32_t height;
+    uint32_t frameCount; // sounds: interleaved PCM
+    uint32_t sampleRate;
+    uint32_t sampleSize;
+    uint32_t channels;
+    uint32_t _padding;
+    uint64_t offset;     // from the start of the pack, ASSET_PACK_ALIGNMENT aligned
+    uint64_t size;
+} AssetPackEntry;
+
+typedef struct AssetPackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t _padding;
+    // followed by entryCount AssetPackEntry
+} AssetPackHeader;
+
+typedef struct AssetPack {
+    FileMap map;
+    AssetPackEntry* entries;
+    uint32_t entryCount;
+} AssetPack;
+
+// Stays mapped for the whole run, the window icon points into it.
+AssetPack assetPack = {0};
+
+bool openAssetPack(AssetPack* pack, const char* path) {
+    if (!fileMapOpen(&pack->map, path)) return false;
+
+    AssetPackHeader* header = pack->map.data;
+    bool isValid = pack->map.size >= sizeof(AssetPackHeader)
+        && header->magic == ASSET_PACK_MAGIC
+        && header->version == ASSET_PACK_VERSION
+        && header->entryCount <= (pack->map.size - sizeof(AssetPackHeader)) / sizeof(AssetPackEntry);
+
+    AssetPackEntry* entries = (AssetPackEntry*) (header + 1);
+    for (size_t i = 0; isValid && i < header->entryCount; i++) {
+        isValid = entries[i].offset <= pack->map.size
+            && entries[i].size <= pack->map.size - entries[i].offset
+            && memchr(entries[i].path, 0, ASSET_PACK_PATH_MAX);
     }
-}
 
-void splashParticlesMove(Array* splashParticles, WaterBody* water, float delta) {
-    
-    for ITERATE(i, splashParticles->used) {
-        SplashParticle* splashParticle = aGet(splashParticles, i);
-        splashParticle->entity.velocity.y += GRAVITY * delta;
-        splashParticle->entity.position = Vector2Add(splashParticle->entity.position, Vector2Scale(splashParticle->entity.velocity, delta));
-        // printf("%f\n", splashParticle->entity.velocity.y);
-
-        bool particleInWater = inWater(water, splashParticle->entity.position);
-        if (!particleInWater) splashParticle->entity.flags &= ~FLAG_SPAWNING;
-        if (particleInWater && !(splashParticle->entity.flags & FLAG_SPAWNING)) {
-            splashParticle->entity.flags |= FLAG_DEAD;
-        }
+    if (!isValid) {
+        fileMapClose(&pack->map);
+        return false;
     }
+
+    pack->entries = entries;
+    pack->entryCount = header->entryCount;
+    return true;
 }
 
-void splashParticlesRender(Array* splashParticles) {
-    
-    for ITERATE(i, splashParticles->used) {
-        SplashParticle* splashParticle = aGet(splashParticles, i);
-        DrawCircle(splashParticle->entity.position.x, splashParticle->entity.position.y, splashParticle->radius, COLOR_MAIN);
+AssetPackEntry* findAssetPackEntry(AssetPack* pack, const char* path, AssetType type) {
+    for ITERATE(i, pack->entryCount) {
+        AssetPackEntry* entry = &pack->entries[i];
+        if (entry->type == type && strcmp(entry->path, path) == 0) return entry;
     }
+    return NULL;
 }
 
+void* getAssetPackData(AssetPack* pack, AssetPackEntry* entry) {
+    return (uint8_t*) pack->map.data + entry->offset;
+}
 
-////////////////////////////////////////////
-// ..BloodParticle
-////////////////////////////////////////////
+Image spriteAtlasImage;
+double spriteAtlasSeconds = 0.0;
 
-#define BLOOD_PARTICLE_MAX_LIFETIME 1.0
-#define BLOOD_PARTICLE_DAMPENING 0.01
+double assetLoadStartTime = 0.0;
 
-void spawnBloodParticle(Array* bloodParticles, Vector2 position, Vector2 velocity) {
+void printAssetTimes(const char* path, double decodeSeconds, double uploadSeconds) {
+    printf("    %-50s decode %8.3f ms, upload %8.3f ms\n", path, decodeSeconds * 1000, uploadSeconds * 1000);
+}
 
-    BloodParticle bloodParticle = {0};
-    bloodParticle.entity.position = position;
-    bloodParticle.entity.velocity = velocity;
-    bloodParticle.lifetime = 0.0;
-    aAppend(bloodParticles, &bloodParticle);
+void decodeAssetsJob(void* data, unsigned int start, unsigned int end) {
+    for (size_t i = start; i < end; i++) {
+        Asset* asset = &ASSETS[i];
+        double startTime = getSeconds();
+        AssetType entryType = asset->type == ASSET_IMAGE ? ASSET_SPRITE : asset->type;
+        AssetPackEntry* entry = findAssetPackEntry(&assetPack, asset->path, entryType);
+        asset->isPacked = entry != NULL;
+
+        if (entry) {
+            void* data = getAssetPackData(&assetPack, entry);
+            switch (asset->type) {
+                case ASSET_SPRITE:
+                case ASSET_IMAGE:   asset->image = (Image){data, entry->width, entry->height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8}; break;
+                case ASSET_VERTEX_SHADER:
+                case ASSET_SHADER:  asset->text = data; break;
+                case ASSET_SOUND:   asset->wave = (Wave){entry->frameCount, entry->sampleRate, entry->sampleSize, entry->channels, data}; break;
+                default:            assert(false);
+            }
+        } else {
+            switch (asset->type) {
+                case ASSET_SPRITE:
+                case ASSET_IMAGE:   asset->image = LoadImage(asset->path); break;
+                case ASSET_VERTEX_SHADER:
+                case ASSET_SHADER:  asset->text = LoadFileText(asset->path); break;
+                case ASSET_SOUND:   asset->wave = LoadWave(asset->path); break;
+                default:            assert(false);
+            }
+        }
+        asset->decodeSeconds = getSeconds() - startTime;
+    }
 }
 
-void bloodParticlesMove(Array* bloodParticles, WaterBody* water, float delta) {
-    
-    for ITERATE(i, bloodParticles->used) {
-        BloodParticle* bloodParticle = aGet(bloodParticles, i);
-        bloodParticle->entity.velocity.y += -GRAVITY * delta * 0.2;
-        bloodParticle->entity.velocity = Vector2Scale(Vector2Normalize(bloodParticle->entity.velocity), Vector2Length(bloodParticle->entity.velocity) * pow(BLOOD_PARTICLE_DAMPENING, delta));
-        bloodParticle->lifetime += delta;
-        bloodParticle->entity.position = Vector2Add(bloodParticle->entity.position, Vector2Scale(bloodParticle->entity.velocity, delta));
+// Shelf pack the decoded sprites into spriteAtlasImage, after a white square
+// for the shapes: left to right, starting a new shelf when a row is full.
+void spriteAtlasJob(void* data, unsigned int start, unsigned int end) {
+    double startTime = getSeconds();
 
-        bool particleInWater = inWater(water, bloodParticle->entity.position);
-        if (!particleInWater) bloodParticle->entity.flags |= FLAG_DEAD;
-        if (bloodParticle->lifetime >= BLOOD_PARTICLE_MAX_LIFETIME) bloodParticle->entity.flags |= FLAG_DEAD;
+    Vector2 cursor = {SPRITE_ATLAS_WHITE_SIZE + SPRITE_ATLAS_PADDING, 0};
+    Vector2 atlasSize = Vector2Side(SPRITE_ATLAS_WHITE_SIZE);
+    float shelfHeight = SPRITE_ATLAS_WHITE_SIZE;
+
+    for ITERATE(i, ASSET_COUNT) {
+        Asset* asset = &ASSETS[i];
+        if (asset->type != ASSET_SPRITE) continue;
+        if (!asset->isPacked) ImageFormat(&asset->image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8); // packed images already are
+
+        if (cursor.x + asset->image.width > SPRITE_ATLAS_MAX_WIDTH) {
+            cursor = (Vector2){0, cursor.y + shelfHeight + SPRITE_ATLAS_PADDING};
+            shelfHeight = 0;
+        }
+        asset->atlasSource = (Rectangle){cursor.x, cursor.y, asset->image.width, asset->image.height};
+        cursor.x += asset->image.width + SPRITE_ATLAS_PADDING;
+        shelfHeight = fmax(shelfHeight, asset->image.height);
+        atlasSize = Vector2Max(atlasSize, (Vector2){cursor.x, cursor.y + shelfHeight});
+    }
+
+    spriteAtlasImage = GenImageColor(atlasSize.x, atlasSize.y, BLANK);
+    Color* pixels = spriteAtlasImage.data;
+    for ITERATE(y, SPRITE_ATLAS_WHITE_SIZE)
+    for ITERATE(x, SPRITE_ATLAS_WHITE_SIZE) {
+        pixels[y * spriteAtlasImage.width + x] = WHITE;
+    }
+
+    for ITERATE(i, ASSET_COUNT) {
+        Asset* asset = &ASSETS[i];
+        if (asset->type != ASSET_SPRITE) continue;
+        Rectangle source = asset->atlasSource;
+        for ITERATE(y, source.height) {
+            memcpy(&pixels[(size_t) (source.y + y) * spriteAtlasImage.width + (size_t) source.x],
+                (Color*) asset->image.data + y * asset->image.width, asset->image.width * sizeof(Color));
+        }
+        if (!asset->isPacked) UnloadImage(asset->image);
     }
+
+    spriteAtlasSeconds = getSeconds() - startTime;
 }
 
-void bloodParticlesRender(Array* bloodParticles) {
-    
-    for ITERATE(i, bloodParticles->used) {
-        BloodParticle* bloodParticle = aGet(bloodParticles, i);
-        Color color = COLOR_HIGHLIGHT;
-        float percentange = Clamp(( bloodParticle->lifetime / BLOOD_PARTICLE_MAX_LIFETIME), 0.0, 1.0);
-        color.a = 255 * (1 - percentange);
-        DrawCircle(bloodParticle->entity.position.x, bloodParticle->entity.position.y, 4 * (1 - percentange), color);
+void fontFileJob(void* data, unsigned int start, unsigned int end) {
+    FontLoad* font = data;
+    double startTime = getSeconds();
+    AssetPackEntry* entry = findAssetPackEntry(&assetPack, font->path, ASSET_FONT);
+    font->isPacked = entry != NULL;
+    if (entry) {
+        font->fileData = getAssetPackData(&assetPack, entry);
+        font->fileSize = entry->size;
+    } else {
+        font->fileData = LoadFileData(font->path, &font->fileSize);
     }
+    font->glyphs = MemAlloc(FONT_GLYPH_COUNT * sizeof(GlyphInfo));
+    font->decodeSeconds = getSeconds() - startTime;
 }
 
+void fontGlyphsJob(void* data, unsigned int start, unsigned int end) {
+    FontLoad* font = data;
+    double startTime = getSeconds();
 
+    int codepoints[FONT_GLYPHS_PER_JOB];
+    for (size_t i = start; i < end; i++) {
+        codepoints[i - start] = FONT_FIRST_CODEPOINT + i;
+    }
 
-////////////////////////////////////////////
-// ..Boid
-////////////////////////////////////////////
+    GlyphInfo* glyphs = LoadFontData(font->fileData, font->fileSize, font->size, codepoints, end - start, FONT_DEFAULT);
+    if (glyphs) {
+        memcpy(&font->glyphs[start], glyphs, (end - start) * sizeof(GlyphInfo));
+        MemFree(glyphs);
+    } else {
+        memset(&font->glyphs[start], 0, (end - start) * sizeof(GlyphInfo));
+    }
+    font->chunkSeconds[start / FONT_GLYPHS_PER_JOB] = getSeconds() - startTime;
+}
 
+// Pack the glyphs like LoadFontEx does, glyph images then point into the atlas.
+void fontAtlasJob(void* data, unsigned int start, unsigned int end) {
+    FontLoad* font = data;
+    double startTime = getSeconds();
 
+    font->atlas = GenImageFontAtlas(font->glyphs, &font->recs, FONT_GLYPH_COUNT, font->size, FONT_GLYPH_PADDING, 0);
+    for ITERATE(i, FONT_GLYPH_COUNT) {
+        UnloadImage(font->glyphs[i].image);
+        font->glyphs[i].image = ImageFromImage(font->atlas, font->recs[i]);
+    }
+    if (!font->isPacked) UnloadFileData(font->fileData);
 
-void initBoidMap(BoidMap* boidMap, Vector2 chunkCount) {
-    boidMap->chunkCount = chunkCount;
-    boidMap->chunks = aCreate(chunkCount.x * chunkCount.y, sizeof(BoidChunk));
-    boidMap->chunks.used = boidMap->chunks.size;
+    font->decodeSeconds += getSeconds() - startTime;
+    for ITERATE(i, sizeof(font->chunkSeconds) / sizeof(font->chunkSeconds[0])) {
+        font->decodeSeconds += font->chunkSeconds[i];
+    }
 }
 
-void cleanBoidMap(BoidMap* boidMap) {
-    aFree(&boidMap->chunks);
+typedef struct FontCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    char fontPath[ASSET_PACK_PATH_MAX];
+    int32_t fontSize;
+    int32_t glyphCount;
+    uint64_t charsetHash;
+    int32_t glyphPadding;
+    int32_t atlasWidth;
+    int32_t atlasHeight;
+    int32_t atlasFormat;
+    uint64_t atlasSize;
+    // followed by glyphCount FontCacheGlyph, then atlasSize bytes of pixels
+} FontCacheHeader;
+
+typedef struct FontCacheGlyph {
+    int32_t value;
+    int32_t offsetX;
+    int32_t offsetY;
+    int32_t advanceX;
+    Rectangle rec;
+} FontCacheGlyph;
+
+// FNV-1a over the codepoints the font is rasterized with.
+uint64_t getFontCharsetHash() {
+    uint64_t hash = 14695981039346656037UL;
+    for ITERATE(i, FONT_GLYPH_COUNT) {
+        int32_t codepoint = FONT_FIRST_CODEPOINT + i;
+        for ITERATE(b, sizeof(codepoint)) {
+            hash ^= ((uint8_t*) &codepoint)[b];
+            hash *= 1099511628211UL;
+        }
+    }
+    return hash;
 }
 
-
-Vector2 getChunkPosition(Vector2 position) {
-    return Vector2Floor(Vector2Divide(position, CHUNK_SIZE));
+FontCacheHeader getFontCacheKey(FontLoad* font) {
+    FontCacheHeader key = {0};
+    key.magic = FONT_CACHE_MAGIC;
+    key.version = FONT_CACHE_VERSION;
+    strncpy(key.fontPath, font->path, ASSET_PACK_PATH_MAX - 1);
+    key.fontSize = font->size;
+    key.glyphCount = FONT_GLYPH_COUNT;
+    key.charsetHash = getFontCharsetHash();
+    key.glyphPadding = FONT_GLYPH_PADDING;
+    return key;
 }
 
-Vector2 getTopLeftOfChunk(Vector2 chunkPosition) {
-    return Vector2Multiply(chunkPosition, CHUNK_SIZE);
+// Map the cache of font if it exists and was made with the same key.
+bool openFontCache(FontLoad* font) {
+    snprintf(font->cachePath, sizeof(font->cachePath), "%s%s", font->path, FONT_CACHE_EXTENSION);
+    if (!fileMapOpen(&font->cacheMap, font->cachePath)) return false;
+
+    FontCacheHeader key = getFontCacheKey(font);
+    FontCacheHeader* header = font->cacheMap.data;
+    size_t glyphsSize = FONT_GLYPH_COUNT * sizeof(FontCacheGlyph);
+    bool isValid = font->cacheMap.size >= sizeof(FontCacheHeader) + glyphsSize
+        && header->magic == key.magic
+        && header->version == key.version
+        && strncmp(header->fontPath, key.fontPath, ASSET_PACK_PATH_MAX) == 0
+        && header->fontSize == key.fontSize
+        && header->glyphCount == key.glyphCount
+        && header->charsetHash == key.charsetHash
+        && header->glyphPadding == key.glyphPadding
+        && header->atlasSize == (uint64_t) GetPixelDataSize(header->atlasWidth, header->atlasHeight, header->atlasFormat)
+        && header->atlasSize <= font->cacheMap.size - sizeof(FontCacheHeader) - glyphsSize;
+
+    if (!isValid) fileMapClose(&font->cacheMap);
+    return isValid;
 }
 
-Vector2 getCenterOfChunk(Vector2 chunkPosition) {
-    return Vector2Multiply(Vector2Add(chunkPosition, (Vector2){0.5, 0.5}), CHUNK_SIZE);
+void fontCacheReadJob(void* data, unsigned int start, unsigned int end) {
+    FontLoad* font = data;
+    double startTime = getSeconds();
+
+    FontCacheHeader* header = font->cacheMap.data;
+    FontCacheGlyph* cacheGlyphs = (FontCacheGlyph*) (header + 1);
+    font->atlas = (Image){cacheGlyphs + FONT_GLYPH_COUNT, header->atlasWidth, header->atlasHeight, 1, header->atlasFormat};
+    font->glyphs = MemAlloc(FONT_GLYPH_COUNT * sizeof(GlyphInfo));
+    font->recs = MemAlloc(FONT_GLYPH_COUNT * sizeof(Rectangle));
+
+    for ITERATE(i, FONT_GLYPH_COUNT) {
+        FontCacheGlyph* cacheGlyph = &cacheGlyphs[i];
+        font->glyphs[i] = (GlyphInfo){cacheGlyph->value, cacheGlyph->offsetX, cacheGlyph->offsetY, cacheGlyph->advanceX};
+        font->glyphs[i].image = ImageFromImage(font->atlas, cacheGlyph->rec);
+        font->recs[i] = cacheGlyph->rec;
+    }
+
+    font->decodeSeconds = getSeconds() - startTime;
 }
 
+void fontCacheWriteJob(void* data, unsigned int start, unsigned int end) {
+    FontLoad* font = data;
+    FILE* file = fopen(font->cachePath, "wb");
+    if (!file) return;
+
+    FontCacheHeader header = getFontCacheKey(font);
+    header.atlasWidth = font->atlas.width;
+    header.atlasHeight = font->atlas.height;
+    header.atlasFormat = font->atlas.format;
+    header.atlasSize = GetPixelDataSize(font->atlas.width, font->atlas.height, font->atlas.format);
+    bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (size_t i = 0; isWritten && i < FONT_GLYPH_COUNT; i++) {
+        GlyphInfo* glyph = &font->glyphs[i];
+        FontCacheGlyph cacheGlyph = {glyph->value, glyph->offsetX, glyph->offsetY, glyph->advanceX, font->recs[i]};
+        isWritten = fwrite(&cacheGlyph, sizeof(cacheGlyph), 1, file) == 1;
+    }
 
-BoidChunk* getChunk(BoidMap* boidMap, Vector2 chunkPosition) {
-    assert(chunkPosition.x == round(chunkPosition.x) && chunkPosition.y == round(chunkPosition.y));
+    isWritten = isWritten && fwrite(font->atlas.data, 1, header.atlasSize, file) == header.atlasSize;
+    fclose(file);
 
-    bool hasChunk = CheckCollisionPointRec(chunkPosition, RectangleFromSize(boidMap->chunkCount));
-    if (!hasChunk)
-        return NULL;
+    // Half a cache would only be rejected next time, don't leave it around.
+    if (!isWritten) remove(font->cachePath);
+}
 
-    unsigned int chunkId = chunkPosition.x + chunkPosition.y * boidMap->chunkCount.x;
-    BoidChunk* boidChunk = aGet(&boidMap->chunks, chunkId);
-    return boidChunk;
+// Without a window the texture only gets its size. keepAtlas, when set,
+// gets an RGBA copy of the atlas.
+void uploadFont(FontLoad* font, bool hasWindow, Image* keepAtlas) {
+    double startTime = getSeconds();
+    Font* target = font->target;
+    target->baseSize = font->size;
+    target->glyphCount = FONT_GLYPH_COUNT;
+    target->glyphPadding = FONT_GLYPH_PADDING;
+    target->texture = hasWindow ? LoadTextureFromImage(font->atlas)
+        : (Texture2D){0, font->atlas.width, font->atlas.height, 1, font->atlas.format};
+    if (keepAtlas) {
+        *keepAtlas = ImageCopy(font->atlas);
+        ImageFormat(keepAtlas, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    }
+    target->recs = font->recs;
+    target->glyphs = font->glyphs;
+    if (font->isCached) fileMapClose(&font->cacheMap);
+    else UnloadImage(font->atlas);
+    font->uploadSeconds = getSeconds() - startTime;
 }
 
-void getBoidsIn(BoidMap* boidMap, Vector2 position, float radius, Array* output) {
-    assert(output->elementSize == sizeof(Boid*));
+// Load everything the first frame needs. Needs the job system, and the
+// window when hasWindow. Without one nothing is uploaded: textures only get
+// their size and shaders stay empty, which is all the software renderer
+// needs. keepImages keeps the CPU side of the sprite and font atlases for it.
+void loadAssets(bool hasWindow, bool keepImages) {
+    assetLoadStartTime = getSeconds();
+    bool hasPack = openAssetPack(&assetPack, ASSET_PACK_PATH);
+
+    JobGraph graph;
+    jobGraphClear(&graph);
+    jobGraphAdd(&graph, "decodeAssets", decodeAssetsJob, NULL, ASSET_COUNT, 1, 0, ASSET_DATA_FILES);
+    jobGraphAdd(&graph, "spriteAtlas", spriteAtlasJob, NULL, 1, 1, ASSET_DATA_FILES, ASSET_DATA_SPRITE_ATLAS);
+    mainFontLoad.isCached = openFontCache(&mainFontLoad);
+    if (mainFontLoad.isCached) {
+        jobGraphAdd(&graph, "fontCacheRead", fontCacheReadJob, &mainFontLoad, 1, 1, ASSET_DATA_FONT_CACHE, ASSET_DATA_FONT_ATLAS);
+    } else {
+        jobGraphAdd(&graph, "fontFile", fontFileJob, &mainFontLoad, 1, 1, 0, ASSET_DATA_FONT_FILE);
+        jobGraphAdd(&graph, "fontGlyphs", fontGlyphsJob, &mainFontLoad, FONT_GLYPH_COUNT, FONT_GLYPHS_PER_JOB, ASSET_DATA_FONT_FILE, ASSET_DATA_FONT_GLYPHS);
+        jobGraphAdd(&graph, "fontAtlas", fontAtlasJob, &mainFontLoad, 1, 1, ASSET_DATA_FONT_GLYPHS, ASSET_DATA_FONT_ATLAS);
+        jobGraphAdd(&graph, "fontCacheWrite", fontCacheWriteJob, &mainFontLoad, 1, 1, ASSET_DATA_FONT_ATLAS, ASSET_DATA_FONT_CACHE);
+    }
+    jobGraphRun(&jobSystem, &graph);
+    double decodedTime = getSeconds();
 
-    Vector2 minChunk = Vector2Max(Vector2Zero(),        Vector2Floor(Vector2Divide(Vector2Add(position, Vector2Side(-radius)), CHUNK_SIZE)));
-    Vector2 maxChunk = Vector2Min(boidMap->chunkCount,  Vector2Ceil (Vector2Divide(Vector2Add(position, Vector2Side(+radius)), CHUNK_SIZE)));
-    
-    Vector2 chunkPosition;
-    for (chunkPosition.y = minChunk.y; chunkPosition.y < maxChunk.y; chunkPosition.y++)
-    for (chunkPosition.x = minChunk.x; chunkPosition.x < maxChunk.x; chunkPosition.x++) {
-        BoidChunk* chunk = getChunk(boidMap, chunkPosition);
-        assert(chunk);
-        
-        Vector2 displacement = Vector2Subtract(getCenterOfChunk(chunkPosition), position);
-       
-        Vector2 closeSide = (Vector2){displacement.x < 0, displacement.y < 0};
-        Vector2 closestPositionInChunk = getTopLeftOfChunk(Vector2Add(chunkPosition, closeSide));
-        if (Vector2Distance(closestPositionInChunk, position) > radius) {
-            // can just ignore the whole chunk without checking distances of each boid
-            continue;
+    double atlasUploadStartTime = getSeconds();
+    if (hasWindow) {
+        SPRITE_ATLAS = LoadTextureFromImage(spriteAtlasImage);
+        SetShapesTexture(SPRITE_ATLAS, (Rectangle){1, 1, SPRITE_ATLAS_WHITE_SIZE - 2, SPRITE_ATLAS_WHITE_SIZE - 2});
+    } else {
+        SPRITE_ATLAS = (Texture2D){0, spriteAtlasImage.width, spriteAtlasImage.height, 1, spriteAtlasImage.format};
+    }
+    if (keepImages) SPRITE_ATLAS_IMAGE = spriteAtlasImage;
+    else UnloadImage(spriteAtlasImage);
+    double atlasUploadSeconds = getSeconds() - atlasUploadStartTime;
+
+    for ITERATE(i, ASSET_COUNT) {
+        Asset* asset = &ASSETS[i];
+        double startTime = getSeconds();
+        switch (asset->type) {
+            case ASSET_SPRITE:
+                *(Sprite*) asset->target = (Sprite){SPRITE_ATLAS, asset->atlasSource};
+                break;
+            case ASSET_IMAGE:
+                *(Image*) asset->target = asset->image;
+                break;
+            case ASSET_SHADER: {
+                Asset* vertexShader = (i > 0 && ASSETS[i - 1].type == ASSET_VERTEX_SHADER) ? &ASSETS[i - 1] : NULL;
+                if (hasWindow) *(Shader*) asset->target = LoadShaderFromMemory(vertexShader ? vertexShader->text : 0, asset->text);
+                if (!asset->isPacked) UnloadFileText(asset->text);
+                if (vertexShader && !vertexShader->isPacked) UnloadFileText(vertexShader->text);
+                break;
+            }
+            default:
+                break;
         }
-
+        asset->uploadSeconds = getSeconds() - startTime;
+    }
+    uploadFont(&mainFontLoad, hasWindow, keepImages ? &MAIN_FONT_IMAGE : NULL);
+
+    if (DEBUG_ENABLED) {
+        double endTime = getSeconds();
+        printf("Assets ready in %.3f ms from %s: decoded in %.3f ms on %u workers, uploaded in %.3f ms\n",
+            (endTime - assetLoadStartTime) * 1000, hasPack ? ASSET_PACK_PATH : "loose files", (decodedTime - assetLoadStartTime) * 1000, jobSystem.workerCount, (endTime - decodedTime) * 1000);
+        printAssetTimes("sprite atlas", spriteAtlasSeconds, atlasUploadSeconds);
+        printAssetTimes(mainFontLoad.isCached ? mainFontLoad.cachePath : mainFontLoad.path, mainFontLoad.decodeSeconds, mainFontLoad.uploadSeconds);
+        for ITERATE(i, ASSET_COUNT) {
+            Asset* asset = &ASSETS[i];
+            if (asset->type != ASSET_SOUND) printAssetTimes(asset->path, asset->decodeSeconds, asset->uploadSeconds);
+        }
+    }
+}
+
+// Upload the sounds decoded by loadAssets, on the thread that will play them.
+void uploadSounds() {
+    for ITERATE(i, ASSET_COUNT) {
+        Asset* asset = &ASSETS[i];
+        if (asset->type != ASSET_SOUND) continue;
+        double startTime = getSeconds();
+        *(Sound*) asset->target = LoadSoundFromWave(asset->wave);
+        if (!asset->isPacked) UnloadWave(asset->wave);
+        asset->uploadSeconds = getSeconds() - startTime;
+    }
+    createSoundVoices();
+
+    if (DEBUG_ENABLED) {
+        printf("Sounds ready %.3f ms after loading started\n", (getSeconds() - assetLoadStartTime) * 1000);
+        for ITERATE(i, ASSET_COUNT) {
+            Asset* asset = &ASSETS[i];
+            if (asset->type == ASSET_SOUND) printAssetTimes(asset->path, asset->decodeSeconds, asset->uploadSeconds);
+        }
+    }
+}
+
+bool writeAssetPackData(FILE* file, AssetPackEntry* entry, const void* data, size_t size) {
+    static const uint8_t padding[ASSET_PACK_ALIGNMENT] = {0};
+    long paddingSize = (ASSET_PACK_ALIGNMENT - ftell(file) % ASSET_PACK_ALIGNMENT) % ASSET_PACK_ALIGNMENT;
+    if (fwrite(padding, 1, paddingSize, file) != (size_t) paddingSize) return false;
+
+    entry->offset = ftell(file);
+    entry->size = size;
+    return fwrite(data, 1, size, file) == size;
+}
+
+// Build step: decode every asset from its own file and write them all, ready
+// to use, to one pack at path.
+bool writeAssetPack(const char* path) {
+    JobGraph graph;
+    jobGraphClear(&graph);
+    jobGraphAdd(&graph, "decodeAssets", decodeAssetsJob, NULL, ASSET_COUNT, 1, 0, ASSET_DATA_FILES);
+    jobGraphRun(&jobSystem, &graph);
+
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+
+    AssetPackHeader header = {ASSET_PACK_MAGIC, ASSET_PACK_VERSION, ASSET_COUNT + 1, 0};
+    AssetPackEntry entries[ASSET_COUNT + 1] = {0};
+    bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(entries, sizeof(entries), 1, file) == 1;
+
+    for (size_t i = 0; isWritten && i < ASSET_COUNT; i++) {
+        Asset* asset = &ASSETS[i];
+        AssetPackEntry* entry = &entries[i];
+        assert(strlen(asset->path) < ASSET_PACK_PATH_MAX);
+        strcpy(entry->path, asset->path);
+        entry->type = asset->type == ASSET_IMAGE ? ASSET_SPRITE : asset->type;
+
+        switch (asset->type) {
+            case ASSET_SPRITE:
+            case ASSET_IMAGE:
+                isWritten = asset->image.data != NULL;
+                if (!isWritten) break;
+                ImageFormat(&asset->image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+                entry->width = asset->image.width;
+                entry->height = asset->image.height;
+                isWritten = writeAssetPackData(file, entry, asset->image.data, (size_t) asset->image.width * asset->image.height * 4);
+                UnloadImage(asset->image);
+                break;
+            case ASSET_VERTEX_SHADER:
+            case ASSET_SHADER:
+                isWritten = asset->text != NULL
+                    && writeAssetPackData(file, entry, asset->text, strlen(asset->text) + 1);
+                UnloadFileText(asset->text);
+                break;
+            case ASSET_SOUND:
+                isWritten = asset->wave.data != NULL;
+                if (!isWritten) break;
+                entry->frameCount = asset->wave.frameCount;
+                entry->sampleRate = asset->wave.sampleRate;
+                entry->sampleSize = asset->wave.sampleSize;
+                entry->channels = asset->wave.channels;
+                isWritten = writeAssetPackData(file, entry, asset->wave.data, (size_t) asset->wave.frameCount * asset->wave.channels * asset->wave.sampleSize / 8);
+                UnloadWave(asset->wave);
+                break;
+            default:
+                assert(false);
+        }
+    }
+
+    if (isWritten) {
+        AssetPackEntry* entry = &entries[ASSET_COUNT];
+        assert(strlen(mainFontLoad.path) < ASSET_PACK_PATH_MAX);
+        strcpy(entry->path, mainFontLoad.path);
+        entry->type = ASSET_FONT;
+        int fileSize = 0;
+        unsigned char* fileData = LoadFileData(mainFontLoad.path, &fileSize);
+        isWritten = fileData && writeAssetPackData(file, entry, fileData, fileSize);
+        UnloadFileData(fileData);
+    }
+
+    // The index goes in last, once every offset is known.
+    isWritten = isWritten
+        && fseek(file, sizeof(header), SEEK_SET) == 0
+        && fwrite(entries, sizeof(entries), 1, file) == 1;
+
+    return fclose(file) == 0 && isWritten;
+}
+
+
+////////////////////////////////////////////
+// ..Entity
+////////////////////////////////////////////
+
+#define GRAVITY 600
+
+// Position between the previous tick (alpha 0) and the current one (alpha 1).
+Vector2 getEntityRenderPosition(Entity* entity, float alpha) {
+    return Vector2Lerp(entity->previousPosition, entity->position, alpha);
+}
+
+void clearDeadEntities(Array* entities) {
+    size_t aliveBoidCount = 0;
+    for ITERATE(i, entities->used) {
+        Entity* entity = aGet(entities, i);
+        bool isDead = (entity->flags & FLAG_DEAD) != 0;
+
+        if (!isDead)
+            aSet(entities, aliveBoidCount, entity);
+
+        aliveBoidCount += !isDead;
+    }
+
+    entities->used = aliveBoidCount;
+}
+
+////////////////////////////////////////////
+// ..Water
+////////////////////////////////////////////
+
+#define WATER_SPRING_CONSTANT 150
+#define WATER_DAMPENING 0.020
+
+// The surface is stepped in segments of WATER_SEGMENT_NODES nodes. A segment
+// falls asleep once all its nodes are within WATER_REST_OFFSET of rest and
+// slower than WATER_REST_VELOCITY, and is set exactly at rest. splashWater
+// wakes the segment it hits, and an awake segment whose edge still moves
+// wakes its neighbor, so the cost follows the disturbance, not the width.
+#define WATER_SEGMENT_NODES 16
+#define WATER_REST_OFFSET 0.05
+#define WATER_REST_VELOCITY 0.5
+
+typedef struct WaterStats {
+    unsigned long steps;
+    unsigned long segments;      // summed over the steps
+    unsigned long awakeSegments; // same
+} WaterStats;
+
+WaterStats waterStats = {0}; // of the world, only touched by its water job
+
+// Set from the command line, used for new worlds. Snapshots keep their own
+// node count.
+typedef struct WaterSettings {
+    float nodesPerDistance;
+    WaterSolver solver;
+} WaterSettings;
+
+WaterSettings waterSettings = {0.1, WATER_SOLVER_EXPLICIT};
+
+void printWaterStats() {
+    if (waterStats.steps == 0) return;
+    printf("Water: %.1f of %.1f segments awake per tick\n",
+        (double) waterStats.awakeSegments / waterStats.steps, (double) waterStats.segments / waterStats.steps);
+}
+
+size_t getWaterSegmentCount(size_t nodeCount) {
+    return (nodeCount + WATER_SEGMENT_NODES - 1) / WATER_SEGMENT_NODES;
+}
+
+void initWaterBody(WaterBody* water, Rectangle bounds, float nodesPerDistance, WaterSolver solver) {
+
+    unsigned int nodeCount = ceil(bounds.width * nodesPerDistance);
+    assert(nodeCount > 1);
+
+    water->bounds = bounds;
+    water->solver = solver;
+    Array* nodeArrays[] = {&water->offsets, &water->nextOffsets, &water->velocities};
+    for ITERATE(i, 3) {
+        *nodeArrays[i] = aCreate(nodeCount, sizeof(float));
+        nodeArrays[i]->used = nodeCount;
+    }
+    water->awakeSegments = aCreate(getWaterSegmentCount(nodeCount), sizeof(bool));
+    water->awakeSegments.used = water->awakeSegments.size;
+    water->naturalOffsets = aCreate(0, sizeof(float));
+    water->wavePhasors = aCreate(0, sizeof(float));
+    water->phasorWaves = aCreate(0, sizeof(WaterWave));
+}
+
+void cleanWaterBody(WaterBody* water) {
+    aFree(&water->offsets);
+    aFree(&water->nextOffsets);
+    aFree(&water->velocities);
+    aFree(&water->awakeSegments);
+    aFree(&water->naturalOffsets);
+    aFree(&water->wavePhasors);
+    aFree(&water->phasorWaves);
+}
+
+void addWaterWaves(Array* waves) {
+    WaterWave wave;
+    wave = (WaterWave){1.0, 200.0, 2.0, 0.0}; aAppend(waves, &wave);
+    wave = (WaterWave){1.0, 73.0, -3, 0.3}; aAppend(waves, &wave);
+    wave = (WaterWave){0.5, 13.0, 4, -0.3}; aAppend(waves, &wave);
+}
+
+size_t getWaterNodeCount(WaterBody* water) {
+    return water->offsets.used;
+}
+
+float getWaterNodeX(WaterBody* water, size_t i) {
+    return water->bounds.x + water->bounds.width * ((float) i) / (getWaterNodeCount(water) - 1);
+}
+
+Vector2 getWaterNodePosition(WaterBody* water, size_t i) {
+    float offset = ((float*) water->offsets.array)[i] + ((float*) water->naturalOffsets.array)[i];
+    return (Vector2){getWaterNodeX(water, i), water->bounds.y + offset};
+}
+
+// Spring step of every run of awake segments with the water's solver.
+void waterBodyUpdate(WaterBody* water, float delta) {
+    size_t nodeCount = getWaterNodeCount(water);
+    size_t segmentCount = water->awakeSegments.used;
+    bool* awakeSegments = water->awakeSegments.array;
+    float stiffness = WATER_SPRING_CONSTANT * delta;
+    float damping = pow(WATER_DAMPENING, delta);
+
+    for (size_t first = 0; first < segmentCount;) {
+        if (!awakeSegments[first]) {
+            first++;
+            continue;
+        }
+        size_t last = first;
+        while (last < segmentCount && awakeSegments[last]) last++;
+
+        size_t start = first * WATER_SEGMENT_NODES;
+        size_t end = fmin(last * WATER_SEGMENT_NODES, nodeCount);
+        if (water->solver == WATER_SOLVER_IMPLICIT) {
+            waterSpringSolveImplicit(water->offsets.array, water->nextOffsets.array, water->velocities.array, nodeCount, start, end, stiffness, damping, delta);
+        } else {
+            waterSpringStep(water->offsets.array, water->nextOffsets.array, water->velocities.array, nodeCount, start, end, stiffness, damping, delta);
+        }
+        waterStats.awakeSegments += last - first;
+        first = last;
+    }
+    waterStats.segments += segmentCount;
+    waterStats.steps++;
+
+    // Sleeping segments hold zeros in both buffers, so swapping all is right.
+    Array previousOffsets = water->offsets;
+    water->offsets = water->nextOffsets;
+    water->nextOffsets = previousOffsets;
+    float* offsets = water->offsets.array;
+    float* nextOffsets = water->nextOffsets.array;
+    float* velocities = water->velocities.array;
+
+    // A segment stays awake while it moves or the facing edge of an awake
+    // neighbor does. Decided for every segment before any of them changes.
+    bool wasPreviousAwake = false;
+    for ITERATE(i, segmentCount) {
+        size_t start = i * WATER_SEGMENT_NODES;
+        size_t end = fmin(start + WATER_SEGMENT_NODES, nodeCount);
+        bool isAwake = awakeSegments[i];
+        bool isMoving = isAwake && !waterNodesAreResting(offsets, velocities, start, end, WATER_REST_OFFSET, WATER_REST_VELOCITY);
+        bool isPulled = (wasPreviousAwake && !waterNodeIsResting(offsets, velocities, start - 1, WATER_REST_OFFSET, WATER_REST_VELOCITY))
+            || (end < nodeCount && awakeSegments[i + 1] && !waterNodeIsResting(offsets, velocities, end, WATER_REST_OFFSET, WATER_REST_VELOCITY));
+
+        if (isAwake && !isMoving && !isPulled) {
+            memset(&offsets[start], 0, (end - start) * sizeof(float));
+            memset(&nextOffsets[start], 0, (end - start) * sizeof(float));
+            memset(&velocities[start], 0, (end - start) * sizeof(float));
+        }
+        wasPreviousAwake = isAwake;
+        awakeSegments[i] = isMoving || isPulled;
+    }
+}
+
+// Rebuilt when the waves or the node count change, which is almost never.
+void updateWavePhasors(WaterBody* water, Array* waves) {
+    size_t nodeCount = getWaterNodeCount(water);
+    bool isCurrent = water->phasorWaves.used == waves->used
+        && water->wavePhasors.used == waves->used * 2 * nodeCount
+        && memcmp(water->phasorWaves.array, waves->array, waves->used * sizeof(WaterWave)) == 0;
+    if (isCurrent) return;
+
+    aCopy(&water->phasorWaves, waves);
+    aReserve(&water->wavePhasors, waves->used * 2 * nodeCount);
+    water->wavePhasors.used = waves->used * 2 * nodeCount;
+    for ITERATE(i, waves->used) {
+        WaterWave* wave = aGet(waves, i);
+        float* sinPhases = (float*) water->wavePhasors.array + i * 2 * nodeCount;
+        waterWavePhasors(sinPhases, sinPhases + nodeCount, nodeCount, getWaterNodeX(water, 0),
+            water->bounds.width / (nodeCount - 1), wave->period, wave->offset);
+    }
+}
+
+// Fill naturalOffsets with the waves at time. Nothing in the simulation
+// depends on them, so this only runs for render snapshots. Each wave is
+// magnitude * sin(2 pi (x / period - offset) - speed * time).
+void updateWaterWaves(WaterBody* water, Array* waves, float time) {
+    updateWavePhasors(water, waves);
+    size_t nodeCount = getWaterNodeCount(water);
+    aReserve(&water->naturalOffsets, nodeCount);
+    water->naturalOffsets.used = nodeCount;
+    float* naturalOffsets = water->naturalOffsets.array;
+    memset(naturalOffsets, 0, nodeCount * sizeof(float));
+
+    for ITERATE(i, waves->used) {
+        WaterWave* wave = aGet(waves, i);
+        float* sinPhases = (float*) water->wavePhasors.array + i * 2 * nodeCount;
+        waterAddWave(naturalOffsets, sinPhases, sinPhases + nodeCount, nodeCount, wave->magnitude, sin(wave->speed * time), cos(wave->speed * time));
+    }
+}
+
+void waterBodyRender(RenderList* list, WaterBody* water) {
+    if (getWaterNodeCount(water) == 0) return;
+
+    Vector2 previousPosition = getWaterNodePosition(water, 0);
+    for (size_t i = 1; i < getWaterNodeCount(water); i++) {
+        Vector2 position = getWaterNodePosition(water, i);
+        recordCapsule(list, LAYER_WATER, previousPosition, position, 2.5, COLOR_MAIN);
+        previousPosition = position;
+    }
+}
+
+size_t getNearestWaterNode(WaterBody* water, Vector2 position) {
+
+    int nodeId = position.x / water->bounds.width * getWaterNodeCount(water);
+    return Clamp(nodeId, 0, getWaterNodeCount(water) - 1);
+}
+
+// Set the velocity of the node nearest to position and wake its segment.
+void splashWater(WaterBody* water, Vector2 position, float velocity) {
+    size_t node = getNearestWaterNode(water, position);
+    ((float*) water->velocities.array)[node] = velocity;
+    ((bool*) water->awakeSegments.array)[node / WATER_SEGMENT_NODES] = true;
+}
+
+bool inWater(WaterBody* water, Vector2 position) {
+    return CheckCollisionPointRec(position, water->bounds);
+}
+
+
+////////////////////////////////////////////
+// ..Particle
+////////////////////////////////////////////
+
+// Spawns past a pool's capacity are dropped, see particle_pool.h.
+typedef struct ParticleStats {
+    unsigned long splashDropped;
+    unsigned long bloodDropped;
+    uint32_t splashPeak; // most particles alive at once
+    uint32_t bloodPeak;
+} ParticleStats;
+
+ParticleStats particleStats = {0}; // of the world, only touched by its snake job
+
+// Count a spawn into pool: its peak, or a drop if it was full.
+void countParticleSpawn(ParticlePool* pool, bool isSpawned, uint32_t* peak, unsigned long* dropped) {
+    if (isSpawned) {
+        if (pool->count > *peak) *peak = pool->count;
+    } else {
+        (*dropped)++;
+    }
+}
+
+void printParticleStats() {
+    printf("Particles alive at most: %u splash, %u blood\n", particleStats.splashPeak, particleStats.bloodPeak);
+    if (particleStats.splashDropped || particleStats.bloodDropped) {
+        printf("Particles dropped with full pools: %lu splash, %lu blood\n", particleStats.splashDropped, particleStats.bloodDropped);
+    }
+}
+
+Vector2 getParticleRenderPosition(Particle* particle, float alpha) {
+    return Vector2Lerp((Vector2){particle->previousX, particle->previousY}, (Vector2){particle->x, particle->y}, alpha);
+}
+
+
+////////////////////////////////////////////
+// ..SplashParticle
+////////////////////////////////////////////
+
+#define SPLASH_PARTICLE_CAPACITY 4096
+
+void spawnSpawnParticles(ParticlePool* splashParticles, Rng* rng, Vector2 position, float speed, unsigned int count) {
+    for ITERATE(i, count) {
+        float radius = RandRange(rng, 1, 6);
+        Vector2 velocity = Vector2Scale(Vector2Rotate((Vector2){0, -1}, RandRange(rng, -PI / 4, PI / 4)), speed * RandRange(rng, 0.8, 1.0) / sqrt(radius));
+        bool isSpawned = particlePoolSpawn(splashParticles, position.x, position.y, velocity.x, velocity.y, radius);
+        countParticleSpawn(splashParticles, isSpawned, &particleStats.splashPeak, &particleStats.splashDropped);
+    }
+}
+
+// Splash particles fly out of the water and die when they fall back in.
+void splashParticlesMove(ParticlePool* splashParticles, WaterBody* water, float delta) {
+    ParticleMotion motion = {GRAVITY, 1, INFINITY, PARTICLE_DIES_BACK_IN_WATER,
+        water->bounds.x, water->bounds.y, water->bounds.width, water->bounds.height};
+    particlePoolStep(splashParticles, &motion, delta);
+}
+
+void splashParticlesRender(RenderList* list, Array* splashParticles, SpatialGrid* grid, Rectangle view, float alpha, CullStats* stats) {
+    SpatialGridRange visible = getVisibleCells(grid, view);
+    size_t drawn = 0;
+
+    for (unsigned int row = visible.firstRow; row <= visible.lastRow; row++) {
+        size_t start, end;
+        spatialGridRowItems(grid, visible, row, &start, &end);
+        for (size_t i = start; i < end; i++) {
+            Particle* splashParticle = aGet(splashParticles, i);
+            recordCircle(list, LAYER_SPLASH, getParticleRenderPosition(splashParticle, alpha), splashParticle->size, COLOR_MAIN);
+        }
+        drawn += end - start;
+    }
+    countCulling(stats, drawn, splashParticles->used);
+}
+
+
+////////////////////////////////////////////
+// ..BloodParticle
+////////////////////////////////////////////
+
+#define BLOOD_PARTICLE_MAX_LIFETIME 1.0
+#define BLOOD_PARTICLE_DAMPENING 0.01
+
+#define BLOOD_PARTICLE_CAPACITY 4096
+
+void spawnBloodParticle(ParticlePool* bloodParticles, Vector2 position, Vector2 velocity) {
+    bool isSpawned = particlePoolSpawn(bloodParticles, position.x, position.y, velocity.x, velocity.y, 4);
+    countParticleSpawn(bloodParticles, isSpawned, &particleStats.bloodPeak, &particleStats.bloodDropped);
+}
+
+// Blood rises slowly and dies when it fades or leaves the water.
+void bloodParticlesMove(ParticlePool* bloodParticles, WaterBody* water, float delta) {
+    ParticleMotion motion = {-GRAVITY * 0.2, BLOOD_PARTICLE_DAMPENING, BLOOD_PARTICLE_MAX_LIFETIME, PARTICLE_DIES_OUT_OF_WATER,
+        water->bounds.x, water->bounds.y, water->bounds.width, water->bounds.height};
+    particlePoolStep(bloodParticles, &motion, delta);
+}
+
+void bloodParticlesRender(RenderList* list, Array* bloodParticles, SpatialGrid* grid, Rectangle view, float alpha, CullStats* stats) {
+    SpatialGridRange visible = getVisibleCells(grid, view);
+    size_t drawn = 0;
+
+    for (unsigned int row = visible.firstRow; row <= visible.lastRow; row++) {
+        size_t start, end;
+        spatialGridRowItems(grid, visible, row, &start, &end);
+        for (size_t i = start; i < end; i++) {
+            Particle* bloodParticle = aGet(bloodParticles, i);
+            Color color = COLOR_HIGHLIGHT;
+            float percentange = Clamp(( bloodParticle->lifetime / BLOOD_PARTICLE_MAX_LIFETIME), 0.0, 1.0);
+            color.a = 255 * (1 - percentange);
+            Vector2 position = getParticleRenderPosition(bloodParticle, alpha);
+            recordCircle(list, LAYER_BLOOD, position, bloodParticle->size * (1 - percentange), color);
+        }
+        drawn += end - start;
+    }
+    countCulling(stats, drawn, bloodParticles->used);
+}
+
+
+
+////////////////////////////////////////////
+// ..Boid
+////////////////////////////////////////////
+
+
+
+void initBoidMap(BoidMap* boidMap, Vector2 chunkCount) {
+    boidMap->chunkCount = chunkCount;
+    boidMap->chunks = aCreate(chunkCount.x * chunkCount.y, sizeof(BoidChunk));
+    boidMap->chunks.used = boidMap->chunks.size;
+}
+
+void cleanBoidMap(BoidMap* boidMap) {
+    aFree(&boidMap->chunks);
+}
+
+
+Vector2 getChunkPosition(Vector2 position) {
+    return Vector2Floor(Vector2Divide(position, CHUNK_SIZE));
+}
+
+Vector2 getTopLeftOfChunk(Vector2 chunkPosition) {
+    return Vector2Multiply(chunkPosition, CHUNK_SIZE);
+}
+
+Vector2 getCenterOfChunk(Vector2 chunkPosition) {
+    return Vector2Multiply(Vector2Add(chunkPosition, (Vector2){0.5, 0.5}), CHUNK_SIZE);
+}
+
+
+BoidChunk* getChunk(BoidMap* boidMap, Vector2 chunkPosition) {
+    assert(chunkPosition.x == round(chunkPosition.x) && chunkPosition.y == round(chunkPosition.y));
+
+    bool hasChunk = CheckCollisionPointRec(chunkPosition, RectangleFromSize(boidMap->chunkCount));
+    if (!hasChunk)
+        return NULL;
+
+    unsigned int chunkId = chunkPosition.x + chunkPosition.y * boidMap->chunkCount.x;
+    BoidChunk* boidChunk = aGet(&boidMap->chunks, chunkId);
+    return boidChunk;
+}
+
+void getBoidsIn(BoidMap* boidMap, Vector2 position, float radius, Array* output) {
+    assert(output->elementSize == sizeof(Boid*));
+
+    Vector2 minChunk = Vector2Max(Vector2Zero(),        Vector2Floor(Vector2Divide(Vector2Add(position, Vector2Side(-radius)), CHUNK_SIZE)));
+    Vector2 maxChunk = Vector2Min(boidMap->chunkCount,  Vector2Ceil (Vector2Divide(Vector2Add(position, Vector2Side(+radius)), CHUNK_SIZE)));
+    
+    Vector2 chunkPosition;
+    for (chunkPosition.y = minChunk.y; chunkPosition.y < maxChunk.y; chunkPosition.y++)
+    for (chunkPosition.x = minChunk.x; chunkPosition.x < maxChunk.x; chunkPosition.x++) {
+        BoidChunk* chunk = getChunk(boidMap, chunkPosition);
+        assert(chunk);
+        
+        Vector2 displacement = Vector2Subtract(getCenterOfChunk(chunkPosition), position);
+       
+        Vector2 closeSide = (Vector2){displacement.x < 0, displacement.y < 0};
+        Vector2 closestPositionInChunk = getTopLeftOfChunk(Vector2Add(chunkPosition, closeSide));
+        if (Vector2Distance(closestPositionInChunk, position) > radius) {
+            // can just ignore the whole chunk without checking distances of each boid
+            continue;
+        }
+
         Vector2 farSide = (Vector2){displacement.x >= 0, displacement.y >= 0};
         Vector2 furthestPositionInChunk = getTopLeftOfChunk(Vector2Add(chunkPosition, farSide));
         if (Vector2Distance(furthestPositionInChunk, position) <= radius && chunk->boidCount) {
@@ -790,14 +2468,15 @@ void populateBoidMap(BoidMap* boidMap, Array* boids) {
 void spawnBoid(World* world, Vector2 position, Vector2 velocity) {
     Boid boid;
     boid.entity.position = position;
+    boid.entity.previousPosition = position;
     boid.entity.velocity = velocity;
     boid.entity.flags = 0 | FLAG_SPAWNING;
     aAppend(&world->boids, &boid);
     //printf("SPAWN BOID\n");
 }
 
-Vector2 getRandomBoidVelocity() {
-    return  Vector2Rotate((Vector2){Lerp(BOID_MIN_SPEED, BOID_MAX_SPEED, RandFloat()), 0}, RandFloat() * 2 * PI);
+Vector2 getRandomBoidVelocity(Rng* rng) {
+    return  Vector2Rotate((Vector2){Lerp(BOID_MIN_SPEED, BOID_MAX_SPEED, RandFloat(rng)), 0}, RandFloat(rng) * 2 * PI);
 }
 
 void boidExplosiveSpawn(World* world, Vector2 position, unsigned int countToSpawn) {
@@ -810,21 +2489,26 @@ void boidExplosiveSpawn(World* world, Vector2 position, unsigned int countToSpaw
     for ITERATE(y, spawnSize.y) {
         if (countSpawned >= countToSpawn) return;
 
-        spawnBoid(world, Vector2Add(spawnTopLeft, (Vector2){x, y}), getRandomBoidVelocity());
+        spawnBoid(world, Vector2Add(spawnTopLeft, (Vector2){x, y}), getRandomBoidVelocity(&world->rngs[RNG_SPAWN]));
         countSpawned++;
     }
 }
 
 
-void boidsReact(Array* boids, BoidMap* boidMap, WaterBody* water, Rectangle bounds, Vector2 pointToAvoid, float delta) {
+// Steer boids [start, end). New velocities go to steering, not the boids, so
+// every boid reacts to the same flock no matter how the range is split.
+void boidsReact(Array* boids, Array* steering, BoidMap* boidMap, WaterBody* water, Rectangle bounds, Vector2 pointToAvoid, size_t start, size_t end, float delta) {
 
-    
+    assert(steering->used == boids->used);
 
     Array flockBoids = aCreate(128, sizeof(Boid*));
-    for ITERATE(i, boids->used) {
+    for (size_t i = start; i < end; i++) {
         Boid* boid = aGet(boids, i);
+        Vector2* velocity = aGet(steering, i);
+        *velocity = boid->entity.velocity;
+
         if (!inWater(water, boid->entity.position)) {
-            boid->entity.velocity.y += GRAVITY * delta;
+            velocity->y += GRAVITY * delta;
             continue;
         }
 
@@ -882,43 +2566,59 @@ void boidsReact(Array* boids, BoidMap* boidMap, WaterBody* water, Rectangle boun
         Vector2 force = Vector2Add(Vector2Add(Vector2Add(Vector2Add(separationForce, alignmentForce), cohesionForce), wallForce), avoidanceForce);
 
         if (Vector2Length(force)) {
-            boid->entity.velocity = Vector2Add(boid->entity.velocity, Vector2Scale(force, delta));
-            boid->entity.velocity = Vector2Scale(Vector2Normalize(boid->entity.velocity), Clamp(Vector2Length(boid->entity.velocity), BOID_MIN_SPEED, BOID_MAX_SPEED));
+            *velocity = Vector2Add(*velocity, Vector2Scale(force, delta));
+            *velocity = Vector2Scale(Vector2Normalize(*velocity), Clamp(Vector2Length(*velocity), BOID_MIN_SPEED, BOID_MAX_SPEED));
         }
     }
 
     aFree(&flockBoids);
 }
 
-void boidsMove(Array* boids, WaterBody* water, Rectangle outerBounds, Rectangle innerBounds, float delta) {
+// Move boids start to end. A boid landing in the water picks its velocity
+// from its own substream of rng, keyed by its index, so any split of the
+// boids into jobs gives the same result.
+void boidsMove(Array* boids, Array* steering, WaterBody* water, const Rng* rng, Rectangle outerBounds, Rectangle innerBounds, size_t start, size_t end, float delta) {
 
     Rectangle outerClampBounds = RectangleReduceAll(outerBounds, BOID_RADIUS);
     Rectangle innerClampBounds = RectangleReduceAll(innerBounds, BOID_RADIUS);
 
-    
-
-    for ITERATE(i, boids->used) {
+    for (size_t i = start; i < end; i++) {
         Boid* boid = aGet(boids, i);
         Rectangle clampBounds = (boid->entity.flags & FLAG_SPAWNING) ? outerClampBounds : innerClampBounds;
+        boid->entity.velocity = *(Vector2*) aGet(steering, i);
+        boid->entity.previousPosition = boid->entity.position;
         boid->entity.position = Vector2Add(boid->entity.position, Vector2Scale(boid->entity.velocity, delta));
         boid->entity.position = Vector2Clamp(boid->entity.position, RectangleTopLeft(clampBounds), RectangleBottomRight(clampBounds));
 
         if ((boid->entity.flags & FLAG_SPAWNING) && inWater(water, boid->entity.position)) {
             boid->entity.flags &= ~FLAG_SPAWNING;
             assert(!(boid->entity.flags & FLAG_SPAWNING));
-            boid->entity.velocity = getRandomBoidVelocity();
+            Rng boidRng = rngDerive(rng, i);
+            boid->entity.velocity = getRandomBoidVelocity(&boidRng);
         }
     }
-
-    
 }
 
-void boidsRender(Array* boids)
+// Each visible row of the grid is one contiguous run of boids.
+void boidsRender(RenderList* list, Array* boids, SpatialGrid* grid, Rectangle view, float alpha, CullStats* stats)
 {
-    for ITERATE(i, boids->used) {
-        Boid* boid = aGet(boids, i);
-        DrawCircle(boid->entity.position.x, boid->entity.position.y, BOID_RADIUS, COLOR_MAIN);
+    SpatialGridRange visible = getVisibleCells(grid, view);
+    size_t drawn = 0;
+
+    for (unsigned int row = visible.firstRow; row <= visible.lastRow; row++) {
+        size_t start, end;
+        spatialGridRowItems(grid, visible, row, &start, &end);
+        if (start == end) continue;
+
+        Boid* first = aGet(boids, start);
+        GeometryCircles circles = {
+            &first->entity.position.x, &first->entity.previousPosition.x, sizeof(Boid),
+            end - start, alpha, BOID_RADIUS, geometryColor(COLOR_MAIN)
+        };
+        recordCircles(list, LAYER_BOIDS, &circles);
+        drawn += end - start;
     }
+    countCulling(stats, drawn, boids->used);
 }
 
 
@@ -936,6 +2636,7 @@ float getBoidBombRadius(unsigned int boidCount) {
 void spawnBoidBomb(World* world, Vector2 position, Vector2 velocity, float time, unsigned int boidCount) {
     BoidBomb boidBomb = {0};
     boidBomb.entity.position = position;
+    boidBomb.entity.previousPosition = position;
     boidBomb.entity.velocity = velocity;
     boidBomb.entity.flags = 0 | FLAG_SPAWNING;
     boidBomb.boidCount = boidCount;
@@ -943,7 +2644,7 @@ void spawnBoidBomb(World* world, Vector2 position, Vector2 velocity, float time,
     aAppend(&world->boidBombs, &boidBomb);
 }
 
-void boidBombsMove(Array* boidBombs, Rectangle bounds, float delta) {
+void boidBombsMove(Array* boidBombs, Array* events, Rectangle bounds, float delta) {
 
     
 
@@ -954,10 +2655,11 @@ void boidBombsMove(Array* boidBombs, Rectangle bounds, float delta) {
         boidBomb->lifetime += delta;
 
         if (fmod(oldLifetime, PLANE_PUT_PERIOD) > fmod(boidBomb->lifetime, PLANE_PUT_PERIOD)) {
-            playSoundInstance(PLANE_SOUND, 0.6, 1.0);
+            emitSound(events, SOUND_PLANE, 0.6, 1.0);
         }
 
         float radius = getBoidBombRadius(boidBomb->boidCount);
+        boidBomb->entity.previousPosition = boidBomb->entity.position;
         boidBomb->entity.position = Vector2Add(boidBomb->entity.position, Vector2Scale(boidBomb->entity.velocity, delta));
 
         bool inBounds = CheckCollisionCircleRec(boidBomb->entity.position, radius, bounds);
@@ -968,33 +2670,66 @@ void boidBombsMove(Array* boidBombs, Rectangle bounds, float delta) {
     }    
 }
 
-void boidBombsRender(Array* boidBombs, float time) {
+void boidBombsRender(RenderList* list, Array* boidBombs, float time, float alpha) {
     for ITERATE(i, boidBombs->used) {
         BoidBomb* boidBomb = aGet(boidBombs, i);
         float radius = getBoidBombRadius(boidBomb->boidCount);
+        Vector2 position = getEntityRenderPosition(&boidBomb->entity, alpha);
         int facing = boidBomb->entity.velocity.x > 0 ? 1 : -1;
         const float planeOffsetY = -15;
 
         Vector2 squash = getSquashScale(fmod(boidBomb->lifetime, PLANE_PUT_PERIOD), 1.05);
 
-        DrawSpriteAnchoredScaled(PLANE_SPRITE, Vector2Add(boidBomb->entity.position, (Vector2){0, -radius + planeOffsetY}), 0, Vector2Multiply(squash, (Vector2){facing, 1}), (Vector2){0.5, 0.5}, COLOR_MAIN);
+        recordSprite(list, LAYER_BOMB_PLANES, PLANE_SPRITE, Vector2Add(position, (Vector2){0, -radius + planeOffsetY}), 0, Vector2Multiply(squash, (Vector2){facing, 1}), (Vector2){0.5, 0.5}, COLOR_MAIN);
         if (!(boidBomb->entity.flags & FLAG_DROPPED)) {
-            DrawSpriteAnchoredScaled(STRING_SPRITE, Vector2Add(boidBomb->entity.position, (Vector2){0, -radius + planeOffsetY + -5}), 0, Vector2Scale(Vector2One(), radius * 2 / 50.0), (Vector2){0.5, 0.0}, COLOR_MAIN);
-            DrawCircle(boidBomb->entity.position.x, boidBomb->entity.position.y, radius, COLOR_MAIN);
-            DrawSpriteAnchoredScaled(FISH_ICON_SPRITE, boidBomb->entity.position, 0, Vector2Scale(Vector2One(), radius * 2 / 200.0 * 0.6), (Vector2){0.5, 0.5},  COLOR_BG);
+            recordSprite(list, LAYER_BOMB_PLANES, STRING_SPRITE, Vector2Add(position, (Vector2){0, -radius + planeOffsetY + -5}), 0, Vector2Scale(Vector2One(), radius * 2 / 50.0), (Vector2){0.5, 0.0}, COLOR_MAIN);
+            recordCircle(list, LAYER_BOMBS, position, radius, COLOR_MAIN);
+            recordSprite(list, LAYER_BOMB_ICONS, FISH_ICON_SPRITE, position, 0, Vector2Scale(Vector2One(), radius * 2 / 200.0 * 0.6), (Vector2){0.5, 0.5},  COLOR_BG);
         }
     }
 }
 
 void popBoidBomb(BoidBomb* boidBomb, World* world) {
     assert(!(boidBomb->entity.flags & FLAG_DROPPED));
-    playSoundInstance(BOMB_EXPLODE_SOUND, 1.5, RandRange(0.9, 1.1));
-    playSoundInstance(HIT_EDGE_SOUND, 1.0, RandRange(0.9, 1.1));
+    emitSound(&world->events, SOUND_BOMB_EXPLODE, 1.5, RandRange(&world->rngs[RNG_PITCH], 0.9, 1.1));
+    emitSound(&world->events, SOUND_HIT_EDGE, 1.0, RandRange(&world->rngs[RNG_PITCH], 0.9, 1.1));
     boidBomb->entity.flags |= FLAG_DROPPED;
     boidExplosiveSpawn(world, boidBomb->entity.position, boidBomb->boidCount);
 }
 
 
+////////////////////////////////////////////
+// ..Input
+////////////////////////////////////////////
+
+enum InputButton {
+    INPUT_LEFT = 1,
+    INPUT_RIGHT = 2,
+    INPUT_UP = 4,
+    INPUT_DOWN = 8,
+    INPUT_DASH = 16,
+};
+
+// Everything the simulation reads from the player during one tick.
+typedef struct InputFrame {
+    uint8_t buttons;
+} InputFrame;
+
+InputFrame pollInput() {
+    InputFrame input = {0};
+    if (IsKeyDown(KEY_A)) input.buttons |= INPUT_LEFT;
+    if (IsKeyDown(KEY_D)) input.buttons |= INPUT_RIGHT;
+    if (IsKeyDown(KEY_W)) input.buttons |= INPUT_UP;
+    if (IsKeyDown(KEY_S)) input.buttons |= INPUT_DOWN;
+    if (IsKeyPressed(KEY_LEFT_SHIFT) || IsKeyPressed(KEY_SPACE)) input.buttons |= INPUT_DASH;
+    return input;
+}
+
+bool inputHas(InputFrame input, enum InputButton button) {
+    return (input.buttons & button) != 0;
+}
+
+
 ////////////////////////////////////////////
 // ..Snake
 ////////////////////////////////////////////
@@ -1017,6 +2752,7 @@ float getComboBonus(float comboLevel) {
 
 void initSnake(Snake* snake, Vector2 position, Vector2 velocity) {
     snake->entity.position = position;
+    snake->entity.previousPosition = position;
     snake->entity.velocity = velocity;
     snake->boostPercent = 0.0;
     snake->boostColdownTimer = 0.0;
@@ -1041,7 +2777,7 @@ void initSnake(Snake* snake, Vector2 position, Vector2 velocity) {
     }
 }
 
-void snakeUpdate(Snake* snake, WaterBody* water, float delta) {
+void snakeUpdate(Snake* snake, World* world, WaterBody* water, InputFrame input, float delta) {
     assert(delta >= 0);
 
     bool couldDash = snake->boostColdownTimer <= 0.0;
@@ -1052,7 +2788,7 @@ void snakeUpdate(Snake* snake, WaterBody* water, float delta) {
     bool canDash = snake->boostColdownTimer <= 0.0;
 
     if (canDash && !couldDash) {
-        playSoundInstance(CAN_DASH_SOUND, 0.5, 1.0);
+        emitSound(&world->events, SOUND_CAN_DASH, 0.5, 1.0);
     }
 
     if (!inWater(water, snake->entity.position)) {
@@ -1061,28 +2797,28 @@ void snakeUpdate(Snake* snake, WaterBody* water, float delta) {
     } else {
         // IN WATER
         Vector2 targetDirection = Vector2Normalize((Vector2) {
-            IsKeyDown(KEY_D) - IsKeyDown(KEY_A),
-            IsKeyDown(KEY_S) - IsKeyDown(KEY_W),
+            inputHas(input, INPUT_RIGHT) - inputHas(input, INPUT_LEFT),
+            inputHas(input, INPUT_DOWN) - inputHas(input, INPUT_UP),
         });
 
         
         
         
         
-        if (IsKeyPressed(KEY_LEFT_SHIFT) || IsKeyPressed(KEY_SPACE)) {
+        if (inputHas(input, INPUT_DASH)) {
             if (canDash) {
                 // boost
                 snake->entity.velocity = Vector2Scale(targetDirection, SNAKE_BOOST_MAX_SPEED);
                 snake->boostColdownTimer = SNAKE_BOOST_COOLDOWN_TIME;
                 snake->clawStretch += 10;
                 
-                gameHasStarted = true;
-                playSoundInstance(DASH_SOUND, 0.4, RandRange(0.9, 1.1) * 0.6);
+                world->gameHasStarted = true;
+                emitSound(&world->events, SOUND_DASH, 0.4, RandRange(&world->rngs[RNG_PITCH], 0.9, 1.1) * 0.6);
                 canDash = false;
 
-                shakeCamera(7.0);
+                emitShake(&world->events, 7.0);
             } else {
-                playSoundInstance(DASH_FAIL_SOUND, 1.0, RandRange(0.9, 1.1) * 0.6);
+                emitSound(&world->events, SOUND_DASH_FAIL, 1.0, RandRange(&world->rngs[RNG_PITCH], 0.9, 1.1) * 0.6);
                 snake->boostPercent = 0.0;
             }
         } else {
@@ -1111,8 +2847,9 @@ void snakeUpdate(Snake* snake, WaterBody* water, float delta) {
     else            snake->entity.flags &= ~FLAG_CAN_DASH;
 }
 
-void snakeMove(Snake* snake, Rectangle bounds, Array* splashParticles, WaterBody* water, float time, float delta) {
+void snakeMove(Snake* snake, World* world, Rectangle bounds, ParticlePool* splashParticles, WaterBody* water, float time, float delta) {
     Vector2 oldPosition = snake->entity.position;
+    snake->entity.previousPosition = oldPosition;
 
     // Move
     snake->entity.position = Vector2Add(snake->entity.position, Vector2Scale(snake->entity.velocity, delta));
@@ -1139,7 +2876,7 @@ void snakeMove(Snake* snake, Rectangle bounds, Array* splashParticles, WaterBody
     }
 
     if (edgeHitSpeed > 0) {
-        playSoundInstance(HIT_EDGE_SOUND, Remap(edgeHitSpeed, 0, SNAKE_MAX_SPEED, 0.3, 1.0), RandRange(0.5, 0.6));
+        emitSound(&world->events, SOUND_HIT_EDGE, Remap(edgeHitSpeed, 0, SNAKE_MAX_SPEED, 0.3, 1.0), RandRange(&world->rngs[RNG_PITCH], 0.5, 0.6));
     }
 
     // Update in water
@@ -1147,20 +2884,19 @@ void snakeMove(Snake* snake, Rectangle bounds, Array* splashParticles, WaterBody
     bool nowInWater = inWater(water, snake->entity.position);
 
     if (wasInWater != nowInWater) {
-        WaterNode* waterNode = getNearestWaterNode(water, snake->entity.position);
-        waterNode->velocityY = snake->entity.velocity.y * 1.6;
+        splashWater(water, snake->entity.position, snake->entity.velocity.y * 1.6);
 
         Vector2 spawnPosition = wasInWater ? snake->entity.position : oldPosition;
 
-        spawnSpawnParticles(splashParticles, Vector2Add(spawnPosition, (Vector2) {-1, 0} ), sqrt(abs(snake->entity.velocity.y)) * 20, Clamp(Remap(abs(snake->entity.velocity.y), 0, SNAKE_MAX_SPEED, 10, 60), 10, 60));
+        spawnSpawnParticles(splashParticles, &world->rngs[RNG_PARTICLE], Vector2Add(spawnPosition, (Vector2) {-1, 0} ), sqrt(abs(snake->entity.velocity.y)) * 20, Clamp(Remap(abs(snake->entity.velocity.y), 0, SNAKE_MAX_SPEED, 10, 60), 10, 60));
         float loudness = Remap(abs(snake->entity.velocity.y), 0, SNAKE_MAX_SPEED, 0.3, 0.8);
         if (wasInWater) {
-            playSoundInstance(SPLASH_OUT_SOUND, loudness, RandRange(0.9, 1.1));
+            emitSound(&world->events, SOUND_SPLASH_OUT, loudness, RandRange(&world->rngs[RNG_PITCH], 0.9, 1.1));
         } else {
-            playSoundInstance(SPLASH_IN_SOUND, loudness, RandRange(0.9, 1.1));
+            emitSound(&world->events, SOUND_SPLASH_IN, loudness, RandRange(&world->rngs[RNG_PITCH], 0.9, 1.1));
         }
 
-        shakeCamera(loudness * 10.0f);
+        emitShake(&world->events, loudness * 10.0f);
 
         // printf("SPLASH\n");
     }
@@ -1183,25 +2919,30 @@ void snakeMove(Snake* snake, Rectangle bounds, Array* splashParticles, WaterBody
     snake->clawStretch = Clamp(snake->clawStretch, 0, 15);
 }
 
-void snakeRender(Snake* snake, float time) {
+void snakeRender(RenderList* list, Snake* snake, float time, float alpha) {
 
     Color bodyColor = (snake->entity.flags & FLAG_CAN_DASH) ? COLOR_MAIN : ColorLerp(COLOR_MAIN, COLOR_BG, 0.1);
 
+    // The body follows the head, so it's shifted back by the same amount as the head.
+    Vector2 headPosition = getEntityRenderPosition(&snake->entity, alpha);
+    Vector2 renderOffset = Vector2Subtract(headPosition, snake->entity.position);
+
     for ITERATE(i, snake->nodes.used - 1) {
         SnakeNode* snakeNode = aGet(&snake->nodes, i + 1);
         float renderRadius = snakeNode->radius + snakeNode->bonusRadius;
-        DrawCircle(snakeNode->position.x, snakeNode->position.y, renderRadius, bodyColor);
-        DrawCircle(snakeNode->position.x, snakeNode->position.y, renderRadius - Lerp(4, 12, pow(snake->boostColdownTimer / SNAKE_BOOST_COOLDOWN_TIME, 0.3)), COLOR_BG);
+        Vector2 position = Vector2Add(snakeNode->position, renderOffset);
+        recordCircle(list, LAYER_SNAKE, position, renderRadius, bodyColor);
+        recordCircle(list, LAYER_SNAKE, position, renderRadius - Lerp(4, 12, pow(snake->boostColdownTimer / SNAKE_BOOST_COOLDOWN_TIME, 0.3)), COLOR_BG);
     }
     
     SnakeNode* snakeNode = aGet(&snake->nodes, 0);
     float renderRadius = snakeNode->radius + snakeNode->bonusRadius;
-    DrawCircle(snake->entity.position.x, snake->entity.position.y, renderRadius, bodyColor);
-    DrawSpriteAnchoredScaled(MANDIBLE_SPRITE, snake->entity.position, RAD2DEG * snake->rotation - snake->clawStretch * 2, (Vector2){1, 1}, (Vector2){0, 1.2}, bodyColor);
-    DrawSpriteAnchoredScaled(MANDIBLE_SPRITE, snake->entity.position, RAD2DEG * snake->rotation + snake->clawStretch * 2, (Vector2){1, -1}, (Vector2){0, 1.2}, bodyColor);
+    recordCircle(list, LAYER_SNAKE, headPosition, renderRadius, bodyColor);
+    recordSprite(list, LAYER_SNAKE_MANDIBLES, MANDIBLE_SPRITE, headPosition, RAD2DEG * snake->rotation - snake->clawStretch * 2, (Vector2){1, 1}, (Vector2){0, 1.2}, bodyColor);
+    recordSprite(list, LAYER_SNAKE_MANDIBLES, MANDIBLE_SPRITE, headPosition, RAD2DEG * snake->rotation + snake->clawStretch * 2, (Vector2){1, -1}, (Vector2){0, 1.2}, bodyColor);
 }
 
-void snakeEat(Snake* snake, World* world, Array* boids, Array* boidBombs, Array* bloodParticles, float time, float delta) {
+void snakeEat(Snake* snake, World* world, Array* boids, Array* boidBombs, ParticlePool* bloodParticles, float time, float delta) {
 
     Vector2 snakeDirection = Vector2Normalize(snake->entity.velocity);
     Vector2 hitboxPosition = Vector2Add(snake->entity.position, Vector2Scale(snakeDirection, 10));
@@ -1227,8 +2968,8 @@ void snakeEat(Snake* snake, World* world, Array* boids, Array* boidBombs, Array*
         popBoidBomb(boidBomb, world);
         snake->clawStretch += 10;
         snake->comboHealth += 0.5;
-        comboFlashPercentage = 1.0;
-        shakeCamera(10.0);
+        emitComboFlash(&world->events);
+        emitShake(&world->events, 10.0);
     }
 
     
@@ -1238,9 +2979,9 @@ void snakeEat(Snake* snake, World* world, Array* boids, Array* boidBombs, Array*
     snake->comboLevel += boidsEaten / (floor(snake->comboLevel) + 1) * 0.03;
 
     if (floor(oldComboLevel) < floor(snake->comboLevel)) {
-        playSoundInstance(LEVEL_UP_SOUND, 1.0, 1.0);
+        emitSound(&world->events, SOUND_LEVEL_UP, 1.0, 1.0);
         snake->comboHealth = 1.0;
-        comboFlashPercentage = 1.0;
+        emitComboFlash(&world->events);
     }
 
     snake->comboHealth -= delta * 0.2 * (floor(snake->comboLevel) > 0);
@@ -1248,7 +2989,7 @@ void snakeEat(Snake* snake, World* world, Array* boids, Array* boidBombs, Array*
     snake->comboHealth = Clamp( snake->comboHealth, 0.0, 1.0);
     // Reset
     if (snake->comboHealth <= 0) {
-        playSoundInstance(LEVEL_RESET_SOUND, 1.0, 1.0);
+        emitSound(&world->events, SOUND_LEVEL_RESET, 1.0, 1.0);
         snake->comboLevel = 0.0;
         snake->comboHealth = 1.0;
     }
@@ -1256,9 +2997,9 @@ void snakeEat(Snake* snake, World* world, Array* boids, Array* boidBombs, Array*
     if (boidsEaten) {
         snake->lastBoidEatenAt = time;
         snake->clawStretch += boidsEaten * 0.5;
-        playSoundInstance(EAT_SOUND, 0.5, Lerp(0.5, 1.0, snake->comboLevel - floor(snake->comboLevel)));
-        playSoundInstance(EAT2_SOUND, 0.7, 1.5);
-        shakeCamera(2.0);
+        emitSound(&world->events, SOUND_EAT, 0.5, Lerp(0.5, 1.0, snake->comboLevel - floor(snake->comboLevel)));
+        emitSound(&world->events, SOUND_EAT2, 0.7, 1.5);
+        emitShake(&world->events, 2.0);
     }
 
     
@@ -1275,72 +3016,1931 @@ void snakeEat(Snake* snake, World* world, Array* boids, Array* boidBombs, Array*
 // ..World
 ////////////////////////////////////////////
 
-void initWorld(World* world, Rectangle bounds, float waterLine)
+void initWorld(World* world, Rectangle bounds, float waterLine, uint64_t seed)
 {
+    // Every stream is seeded from the one world seed, so a seed reproduces the whole simulation.
+    world->seed = seed;
+    for ITERATE(i, RNG_STREAM_COUNT) {
+        world->rngs[i] = rngCreate(seed, i);
+    }
+
     world->boids = aCreate(128, sizeof(Boid));
     world->boidBombs = aCreate(8, sizeof(BoidBomb));
-    world->splashParticles = aCreate(64, sizeof(SplashParticle));
-    world->bloodParticles = aCreate(64, sizeof(BloodParticle));
+    particlePoolInit(&world->splashParticles, SPLASH_PARTICLE_CAPACITY);
+    particlePoolInit(&world->bloodParticles, BLOOD_PARTICLE_CAPACITY);
     initBoidMap(&world->boidMap, Vector2Ceil(Vector2Divide(RectangleSize(bounds), CHUNK_SIZE))); 
+    world->boidSteering = aCreate(128, sizeof(Vector2));
     initSnake(&world->snake, RectangleCenter(bounds), Vector2Zero());
 
+    world->events = aCreate(64, sizeof(SimEvent));
+    world->waves = aCreate(4, sizeof(WaterWave));
+    addWaterWaves(&world->waves);
+
     world->boidBombSpawnTime = 0;
+    world->time = 0;
+    world->snapshotMap = (FileMap){0};
+    world->gameHasStarted = false;
+    world->shakeStrength = 0.0;
+    world->shakeOffset = Vector2Zero();
+    world->comboFlashPercentage = 0.0;
     world->bounds = bounds;
     Rectangle waterBounds = bounds;
     waterBounds.y += waterLine;
     waterBounds.height -= waterLine;
-    initWaterBody(&world->water, waterBounds, 0.1);
+    initWaterBody(&world->water, waterBounds, waterSettings.nodesPerDistance, waterSettings.solver);
 }
 
 void cleanWorld(World* world)
 {
     aFree(&world->boids);
+    aFree(&world->boidBombs);
+    particlePoolFree(&world->splashParticles);
+    particlePoolFree(&world->bloodParticles);
+    aFree(&world->snake.nodes);
+    aFree(&world->waves);
+    aFree(&world->events);
+    aFree(&world->boidSteering);
     cleanBoidMap(&world->boidMap);
     cleanWaterBody(&world->water);
+    fileMapClose(&world->snapshotMap);
 }
 
-////////////////////////////////////////////
-// ..Main
-////////////////////////////////////////////
+// What the system jobs of one tick work on.
+typedef struct WorldTick {
+    World* world;
+    InputFrame input;
+    float delta;
+    Rng boidsMoveRng; // parent of the per boid streams of this tick
+} WorldTick;
+
+void boidMapJob(void* data, unsigned int start, unsigned int end) {
+    WorldTick* tick = data;
+    clearBoidMap(&tick->world->boidMap);
+    populateBoidMap(&tick->world->boidMap, &tick->world->boids);
+}
 
- 
+void boidsReactJob(void* data, unsigned int start, unsigned int end) {
+    WorldTick* tick = data;
+    World* world = tick->world;
+    boidsReact(&world->boids, &world->boidSteering, &world->boidMap, &world->water, world->water.bounds, world->snake.entity.position, start, end, tick->delta);
+}
 
-#define WATER_LINE 225.0
+void boidsMoveJob(void* data, unsigned int start, unsigned int end) {
+    WorldTick* tick = data;
+    World* world = tick->world;
+    boidsMove(&world->boids, &world->boidSteering, &world->water, &tick->boidsMoveRng, world->bounds, world->water.bounds, start, end, tick->delta);
+}
 
-//------------------------------------------------------------------------------------
-// Program main entry point
-//------------------------------------------------------------------------------------
-int main(void) {
-    // Initialization
-    //--------------------------------------------------------------------------------------
-    Vector2 screenSize = (Vector2){800, 800};
+void boidBombsMoveJob(void* data, unsigned int start, unsigned int end) {
+    WorldTick* tick = data;
+    World* world = tick->world;
+    boidBombsMove(&world->boidBombs, &world->events, world->bounds, tick->delta);
+}
 
-    
-    World currentWorld;
-    initWorld(&currentWorld, RectangleFromSize(screenSize), WATER_LINE);
+void snakeJob(void* data, unsigned int start, unsigned int end) {
+    WorldTick* tick = data;
+    World* world = tick->world;
+    snakeUpdate(&world->snake, world, &world->water, tick->input, tick->delta);
+    snakeMove(&world->snake, world, world->bounds, &world->splashParticles, &world->water, world->time, tick->delta);
+    snakeEat(&world->snake, world, &world->boids, &world->boidBombs, &world->bloodParticles, world->time, tick->delta);
+}
+
+void waterJob(void* data, unsigned int start, unsigned int end) {
+    WorldTick* tick = data;
+    World* world = tick->world;
+    waterBodyUpdate(&world->water, tick->delta);
+}
+
+void splashParticlesJob(void* data, unsigned int start, unsigned int end) {
+    WorldTick* tick = data;
+    splashParticlesMove(&tick->world->splashParticles, &tick->world->water, tick->delta);
+}
+
+void bloodParticlesJob(void* data, unsigned int start, unsigned int end) {
+    WorldTick* tick = data;
+    bloodParticlesMove(&tick->world->bloodParticles, &tick->world->water, tick->delta);
+}
 
-    Array waves = aCreate(2, sizeof(WaterWave));
-    {
-        WaterWave wave;
-        wave = (WaterWave){1.0, 200.0, 2.0, 0.0}; aAppend(&waves, &wave);
-        wave = (WaterWave){1.0, 73.0, -3, 0.3}; aAppend(&waves, &wave);
-        wave = (WaterWave){0.5, 13.0, 4, -0.3}; aAppend(&waves, &wave);
+// Advance the simulation by one fixed tick.
+void worldUpdate(World* world, InputFrame input, float delta) {
+    world->shakeStrength = Lerp(world->shakeStrength, 0.0, delta * 5);
+    Rng* shakeRng = &world->rngs[RNG_SHAKE];
+    world->shakeOffset = (Vector2){ RandRange(shakeRng, -world->shakeStrength, world->shakeStrength), RandRange(shakeRng, -world->shakeStrength, world->shakeStrength)};
+    world->comboFlashPercentage = Lerp(world->comboFlashPercentage, 0.0, delta * 5);
+
+    if (world->gameHasStarted) {
+        world->boidBombSpawnTime -= delta;
+        if (world->boidBombSpawnTime <= 0.0) {
+            Rng* spawnRng = &world->rngs[RNG_SPAWN];
+            world->boidBombSpawnTime = RandRange(spawnRng, 5.0, 8.0);
+
+            if (world->boids.used < 2000) {
+                bool spawnOnLeft = RandBool(spawnRng);
+                spawnBoidBomb(
+                    world, 
+                    (Vector2) {spawnOnLeft ? -40 : world->bounds.width + 40, Lerp(40, WATER_LINE - 40, RandFloat(spawnRng))}, 
+                    (Vector2) {(spawnOnLeft ? 1 : -1) * Lerp(40, 60, RandFloat(spawnRng)), 0},
+                    world->time,
+                    Lerp(200, 800, RandFloat(spawnRng))
+                );
+            }
+        }
     }
-    float fixedTime = 0.0;
 
-    Color COLOR_DARK = GetColor(0x171738FF);
-    Color COLOR_LIGHT = GetColor(0xC1DBE3FF);
+    clearDeadEntities(&world->boids);
+    clearDeadEntities(&world->boidBombs);
+
+    aReserve(&world->boidSteering, world->boids.used);
+    world->boidSteering.used = world->boids.used;
+
+    // Systems in their serial order. Each runs as soon as the earlier ones
+    // touching the same data are done. boidsReact and boidsMove are split into
+    // chunks. Water and particles step before the snake, which splashes and
+    // spawns into them, so they overlap the boid pipeline; what the snake adds
+    // starts moving on the next tick. Systems only read the water's bounds,
+    // which never change, so only the snake declares the water.
+    // boidsMove only derives from its copy, the spawn stream moves on once per tick.
+    WorldTick tick = {world, input, delta, world->rngs[RNG_SPAWN]};
+    rngNext(&world->rngs[RNG_SPAWN]);
+    JobGraph graph;
+    jobGraphClear(&graph);
+    jobGraphAdd(&graph, "boidMap", boidMapJob, &tick, 1, 1,
+        SIM_DATA_BOIDS, SIM_DATA_BOID_MAP);
+    jobGraphAdd(&graph, "boidsReact", boidsReactJob, &tick, world->boids.used, SIM_JOB_CHUNK_SIZE,
+        SIM_DATA_BOIDS | SIM_DATA_BOID_MAP | SIM_DATA_SNAKE, SIM_DATA_BOID_STEERING);
+    jobGraphAdd(&graph, "boidsMove", boidsMoveJob, &tick, world->boids.used, SIM_JOB_CHUNK_SIZE,
+        SIM_DATA_BOID_STEERING, SIM_DATA_BOIDS);
+    jobGraphAdd(&graph, "boidBombsMove", boidBombsMoveJob, &tick, 1, 1,
+        0, SIM_DATA_BOID_BOMBS | SIM_DATA_EVENTS);
+    jobGraphAdd(&graph, "water", waterJob, &tick, 1, 1,
+        0, SIM_DATA_WATER);
+    jobGraphAdd(&graph, "splashParticles", splashParticlesJob, &tick, 1, 1,
+        0, SIM_DATA_SPLASH_PARTICLES);
+    jobGraphAdd(&graph, "bloodParticles", bloodParticlesJob, &tick, 1, 1,
+        0, SIM_DATA_BLOOD_PARTICLES);
+    jobGraphAdd(&graph, "snake", snakeJob, &tick, 1, 1,
+        0, SIM_DATA_SNAKE | SIM_DATA_BOIDS | SIM_DATA_BOID_BOMBS | SIM_DATA_WATER | SIM_DATA_SPLASH_PARTICLES | SIM_DATA_BLOOD_PARTICLES | SIM_DATA_EVENTS | SIM_DATA_RNGS);
+    jobGraphRun(&jobSystem, &graph);
+
+    world->time += delta;
+}
+
+////////////////////////////////////////////
+// ..Snapshot
+////////////////////////////////////////////
+
+// A snapshot is a SnapshotHeader followed by the raw contents of every world
+// array, each starting on a SNAPSHOT_ALIGNMENT boundary. Loading maps the
+// file and points the arrays straight at it, nothing is parsed or copied.
+// Particle pools are the exception: they are written as Particle records and
+// copied back into pools of their fixed capacity.
+#define SNAPSHOT_MAGIC 0x534D4F4E // "NOMS"
+#define SNAPSHOT_VERSION 7
+#define SNAPSHOT_ALIGNMENT 16
+
+enum SnapshotSectionId {
+    SNAPSHOT_BOIDS,
+    SNAPSHOT_BOID_BOMBS,
+    SNAPSHOT_SPLASH_PARTICLES,
+    SNAPSHOT_BLOOD_PARTICLES,
+    SNAPSHOT_SNAKE_NODES,
+    SNAPSHOT_WATER_OFFSETS,
+    SNAPSHOT_WATER_VELOCITIES,
+    SNAPSHOT_WATER_SEGMENTS,
+    SNAPSHOT_WAVES,
+    SNAPSHOT_SECTION_COUNT,
+};
+
+typedef struct SnapshotSection {
+    uint64_t offset;
+    uint64_t count;
+    uint64_t elementSize;
+} SnapshotSection;
+
+// Snake without its nodes array, which has its own section.
+typedef struct SnapshotSnake {
+    Entity entity;
+    float boostPercent;
+    float boostColdownTimer;
+    float score;
+    float comboLevel;
+    float comboHealth;
+    float rotation;
+    float lastBoidEatenAt;
+    float clawStretch;
+} SnapshotSnake;
+
+typedef struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seed;
+    Rng rngs[RNG_STREAM_COUNT];
+    Rectangle bounds;
+    Rectangle waterBounds;
+    SnapshotSnake snake;
+    float boidBombSpawnTime;
+    float time;
+    uint32_t gameHasStarted;
+    float shakeStrength;
+    float comboFlashPercentage;
+    SnapshotSection sections[SNAPSHOT_SECTION_COUNT];
+} SnapshotHeader;
+
+static const size_t SNAPSHOT_ELEMENT_SIZES[SNAPSHOT_SECTION_COUNT] = {
+    [SNAPSHOT_BOIDS]            = sizeof(Boid),
+    [SNAPSHOT_BOID_BOMBS]       = sizeof(BoidBomb),
+    [SNAPSHOT_SPLASH_PARTICLES] = sizeof(Particle),
+    [SNAPSHOT_BLOOD_PARTICLES]  = sizeof(Particle),
+    [SNAPSHOT_SNAKE_NODES]      = sizeof(SnakeNode),
+    [SNAPSHOT_WATER_OFFSETS]    = sizeof(float),
+    [SNAPSHOT_WATER_VELOCITIES] = sizeof(float),
+    [SNAPSHOT_WATER_SEGMENTS]   = sizeof(bool),
+    [SNAPSHOT_WAVES]            = sizeof(WaterWave),
+};
+
+Array* getSnapshotSectionArray(World* world, enum SnapshotSectionId id) {
+    switch (id) {
+        case SNAPSHOT_BOIDS:            return &world->boids;
+        case SNAPSHOT_BOID_BOMBS:       return &world->boidBombs;
+        case SNAPSHOT_SNAKE_NODES:      return &world->snake.nodes;
+        case SNAPSHOT_WATER_OFFSETS:    return &world->water.offsets;
+        case SNAPSHOT_WATER_VELOCITIES: return &world->water.velocities;
+        case SNAPSHOT_WATER_SEGMENTS:   return &world->water.awakeSegments;
+        case SNAPSHOT_WAVES:            return &world->waves;
+        default:                        return NULL; // a particle pool
+    }
+}
+
+ParticlePool* getSnapshotParticlePool(World* world, enum SnapshotSectionId id, uint32_t* capacity) {
+    switch (id) {
+        case SNAPSHOT_SPLASH_PARTICLES: *capacity = SPLASH_PARTICLE_CAPACITY; return &world->splashParticles;
+        case SNAPSHOT_BLOOD_PARTICLES:  *capacity = BLOOD_PARTICLE_CAPACITY; return &world->bloodParticles;
+        default:                        assert(false); return NULL;
+    }
+}
+
+// The section's contents, as an array owned by the world or a copy.
+Array getSnapshotSection(World* world, enum SnapshotSectionId id) {
+    Array* array = getSnapshotSectionArray(world, id);
+    if (array) return aBorrow(array->array, array->used, array->elementSize);
+
+    uint32_t capacity;
+    ParticlePool* pool = getSnapshotParticlePool(world, id, &capacity);
+    Array particles = aCreate(pool->count, sizeof(Particle));
+    particles.used = pool->count;
+    particlePoolCopyOut(pool, particles.array);
+    return particles;
+}
+
+bool saveWorldSnapshot(World* world, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+
+    SnapshotHeader header = {0};
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.seed = world->seed;
+    memcpy(header.rngs, world->rngs, sizeof(header.rngs));
+    header.bounds = world->bounds;
+    header.waterBounds = world->water.bounds;
+    header.snake = (SnapshotSnake){
+        world->snake.entity, world->snake.boostPercent, world->snake.boostColdownTimer, world->snake.score,
+        world->snake.comboLevel, world->snake.comboHealth, world->snake.rotation, world->snake.lastBoidEatenAt,
+        world->snake.clawStretch,
+    };
+    header.boidBombSpawnTime = world->boidBombSpawnTime;
+    header.time = world->time;
+    header.gameHasStarted = world->gameHasStarted;
+    header.shakeStrength = world->shakeStrength;
+    header.comboFlashPercentage = world->comboFlashPercentage;
+
+    Array sections[SNAPSHOT_SECTION_COUNT];
+    uint64_t offset = sizeof(SnapshotHeader);
+    for ITERATE(i, SNAPSHOT_SECTION_COUNT) {
+        sections[i] = getSnapshotSection(world, i);
+        offset = (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+        header.sections[i] = (SnapshotSection){offset, sections[i].used, sections[i].elementSize};
+        offset += sections[i].used * sections[i].elementSize;
+    }
+
+    bool isWritten = fwrite(&header, sizeof(SnapshotHeader), 1, file) == 1;
+    for ITERATE(i, SNAPSHOT_SECTION_COUNT) {
+        Array* array = &sections[i];
+        static const uint8_t padding[SNAPSHOT_ALIGNMENT] = {0};
+        long paddingSize = header.sections[i].offset - ftell(file);
+        isWritten = isWritten && fwrite(padding, 1, paddingSize, file) == (size_t) paddingSize;
+        isWritten = isWritten && fwrite(array->array, array->elementSize, array->used, file) == array->used;
+        aFree(array);
+    }
+
+    isWritten = fclose(file) == 0 && isWritten;
+    return isWritten;
+}
+
+// Replace world with the snapshot at path. The world must not be initialized,
+// release it with cleanWorld as usual. Returns false if the file is missing,
+// from another version or doesn't match this build's struct layout.
+bool loadWorldSnapshot(World* world, const char* path) {
+    FileMap map;
+    if (!fileMapOpen(&map, path)) return false;
+
+    SnapshotHeader* header = map.data;
+    bool isValid = map.size >= sizeof(SnapshotHeader)
+        && header->magic == SNAPSHOT_MAGIC
+        && header->version == SNAPSHOT_VERSION;
+
+    for (size_t i = 0; isValid && i < SNAPSHOT_SECTION_COUNT; i++) {
+        SnapshotSection section = header->sections[i];
+        isValid = section.elementSize == SNAPSHOT_ELEMENT_SIZES[i]
+            && section.offset % SNAPSHOT_ALIGNMENT == 0
+            && section.offset <= map.size
+            && section.count <= (map.size - section.offset) / section.elementSize;
+    }
+
+    uint64_t waterNodeCount = isValid ? header->sections[SNAPSHOT_WATER_OFFSETS].count : 0;
+    isValid = isValid && waterNodeCount > 1
+        && header->sections[SNAPSHOT_WATER_VELOCITIES].count == waterNodeCount
+        && header->sections[SNAPSHOT_WATER_SEGMENTS].count == getWaterSegmentCount(waterNodeCount)
+        && header->sections[SNAPSHOT_SNAKE_NODES].count == SNAKE_NODE_COUNT
+        && header->sections[SNAPSHOT_SPLASH_PARTICLES].count <= SPLASH_PARTICLE_CAPACITY
+        && header->sections[SNAPSHOT_BLOOD_PARTICLES].count <= BLOOD_PARTICLE_CAPACITY;
+
+    if (!isValid) {
+        fileMapClose(&map);
+        return false;
+    }
+
+    world->seed = header->seed;
+    memcpy(world->rngs, header->rngs, sizeof(world->rngs));
+    world->bounds = header->bounds;
+    world->water.bounds = header->waterBounds;
+    world->water.solver = waterSettings.solver;
+    SnapshotSnake snake = header->snake;
+    world->snake = (Snake){
+        snake.entity, {0}, snake.boostPercent, snake.boostColdownTimer, snake.score,
+        snake.comboLevel, snake.comboHealth, snake.rotation, snake.lastBoidEatenAt,
+        snake.clawStretch,
+    };
+    world->boidBombSpawnTime = header->boidBombSpawnTime;
+    world->time = header->time;
+    world->gameHasStarted = header->gameHasStarted;
+    world->shakeStrength = header->shakeStrength;
+    world->shakeOffset = Vector2Zero();
+    world->comboFlashPercentage = header->comboFlashPercentage;
+
+    for ITERATE(i, SNAPSHOT_SECTION_COUNT) {
+        SnapshotSection section = header->sections[i];
+        void* data = (uint8_t*) map.data + section.offset;
+        Array* array = getSnapshotSectionArray(world, i);
+        if (array) {
+            *array = aBorrow(data, section.count, section.elementSize);
+        } else {
+            uint32_t capacity;
+            ParticlePool* pool = getSnapshotParticlePool(world, i, &capacity);
+            particlePoolInit(pool, capacity);
+            particlePoolCopyIn(pool, data, section.count);
+        }
+    }
+
+    initBoidMap(&world->boidMap, Vector2Ceil(Vector2Divide(RectangleSize(world->bounds), CHUNK_SIZE)));
+    world->boidSteering = aCreate(128, sizeof(Vector2));
+    world->events = aCreate(64, sizeof(SimEvent));
+    world->water.nextOffsets = aCreate(world->water.offsets.used, sizeof(float));
+    world->water.nextOffsets.used = world->water.offsets.used;
+    world->water.naturalOffsets = aCreate(0, sizeof(float));
+    world->water.wavePhasors = aCreate(0, sizeof(float));
+    world->water.phasorWaves = aCreate(0, sizeof(WaterWave));
+    world->snapshotMap = map;
+    return true;
+}
+
+
+////////////////////////////////////////////
+// ..Replay
+////////////////////////////////////////////
+
+// A recording is a RecordingHeader followed by InputRuns until the end of the file.
+#define RECORDING_MAGIC 0x524D4F4E // "NOMR"
+#define RECORDING_VERSION 1
+
+typedef struct RecordingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seed;
+} RecordingHeader;
+
+// Consecutive ticks with identical input are stored as one run.
+typedef struct InputRun {
+    uint8_t buttons;
+    uint8_t tickCount;
+} InputRun;
+
+typedef struct InputRecorder {
+    FILE* file;
+    InputRun run;
+} InputRecorder;
+
+bool startRecording(InputRecorder* recorder, const char* path, uint64_t seed) {
+    recorder->file = fopen(path, "wb");
+    recorder->run = (InputRun){0};
+    if (!recorder->file) return false;
+
+    RecordingHeader header = {RECORDING_MAGIC, RECORDING_VERSION, seed};
+    fwrite(&header, sizeof(RecordingHeader), 1, recorder->file);
+    return true;
+}
+
+void recordInput(InputRecorder* recorder, InputFrame input) {
+    if (!recorder->file) return;
+
+    bool runEnded = recorder->run.buttons != input.buttons || recorder->run.tickCount == UINT8_MAX;
+    if (recorder->run.tickCount && runEnded) {
+        fwrite(&recorder->run, sizeof(InputRun), 1, recorder->file);
+        recorder->run.tickCount = 0;
+    }
+
+    recorder->run.buttons = input.buttons;
+    recorder->run.tickCount++;
+}
+
+void stopRecording(InputRecorder* recorder) {
+    if (!recorder->file) return;
+
+    if (recorder->run.tickCount)
+        fwrite(&recorder->run, sizeof(InputRun), 1, recorder->file);
+
+    fclose(recorder->file);
+    recorder->file = NULL;
+}
+
+// Expand a recording into one InputFrame per tick. Returns false if the file
+// is missing or not a recording of this version.
+bool loadRecording(const char* path, uint64_t* seed, Array* inputs) {
+    assert(inputs->elementSize == sizeof(InputFrame));
+
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+
+    RecordingHeader header;
+    bool isValid = fread(&header, sizeof(RecordingHeader), 1, file) == 1
+        && header.magic == RECORDING_MAGIC
+        && header.version == RECORDING_VERSION;
+
+    InputRun run;
+    while (isValid && fread(&run, sizeof(InputRun), 1, file) == 1) {
+        InputFrame input = {run.buttons};
+        for ITERATE(i, run.tickCount) {
+            aAppend(inputs, &input);
+        }
+    }
+
+    fclose(file);
+    *seed = header.seed;
+    return isValid;
+}
+
+// FNV-1a over the state a replay should reproduce exactly.
+uint64_t getWorldChecksum(World* world) {
+    uint64_t hash = 14695981039346656037UL;
+    #define CHECKSUM_BYTES(DATA, SIZE) for ITERATE(b, SIZE) { hash ^= ((uint8_t*) (DATA))[b]; hash *= 1099511628211UL; }
+
+    for ITERATE(i, world->boids.used) {
+        Boid* boid = aGet(&world->boids, i);
+        CHECKSUM_BYTES(&boid->entity.position, sizeof(Vector2));
+    }
+    CHECKSUM_BYTES(&world->snake.entity.position, sizeof(Vector2));
+    CHECKSUM_BYTES(&world->snake.score, sizeof(float));
+
+    #undef CHECKSUM_BYTES
+    return hash;
+}
+
+// Start world from the snapshot at path, or from scratch if path is NULL.
+bool startWorld(World* world, uint64_t seed, const char* snapshotPath) {
+    if (!snapshotPath) {
+        initWorld(world, RectangleFromSize(SCREEN_SIZE), WATER_LINE, seed);
+        return true;
+    }
+
+    double startTime = getSeconds();
+    if (!loadWorldSnapshot(world, snapshotPath)) {
+        printf("Could not load snapshot %s\n", snapshotPath);
+        return false;
+    }
+    printf("Loaded snapshot %s (%zu boids) in %.2fms\n", snapshotPath, world->boids.used, (getSeconds() - startTime) * 1000);
+    return true;
+}
+
+void startFrameExport(const char* directory); // see ..SoftwareRender
+void exportFrame(World* world);
+bool stopFrameExport();
+
+// Run a recording through the simulation without a window, audio or frame cap.
+// With exportFramesPath every tick is also rendered in software and saved.
+int runReplay(const char* path, const char* loadSnapshotPath, const char* saveSnapshotPath, const char* exportFramesPath) {
+    uint64_t seed;
+    Array inputs = aCreate(1024, sizeof(InputFrame));
+    if (!loadRecording(path, &seed, &inputs)) {
+        printf("Could not load recording %s\n", path);
+        aFree(&inputs);
+        return 1;
+    }
+
+    World world;
+    if (!startWorld(&world, seed, loadSnapshotPath)) {
+        aFree(&inputs);
+        return 1;
+    }
+
+    EventSink sink = {0};
+    sink.isHeadless = true;
+    if (exportFramesPath) startFrameExport(exportFramesPath);
+
+    double startTime = getSeconds();
+    for ITERATE(i, inputs.used) {
+        worldUpdate(&world, *(InputFrame*) aGet(&inputs, i), FIXED_DELTA);
+        applySimEvents(&world, &sink);
+        if (exportFramesPath) exportFrame(&world);
+    }
+    double elapsed = getSeconds() - startTime;
+
+    printf("Replayed %zu ticks in %.3fs (%.0f ticks/s)\n", inputs.used, elapsed, inputs.used / fmax(elapsed, 1e-9));
+    printf("Seed %llu, score %d, boids %zu, checksum %016llx\n",
+        (unsigned long long) world.seed, (int) floor(world.snake.score), world.boids.used, (unsigned long long) getWorldChecksum(&world));
+
+    printf("Events: %lu sound, %lu shake, %lu combo flash\n",
+        sink.counts[SIM_EVENT_SOUND], sink.counts[SIM_EVENT_SHAKE], sink.counts[SIM_EVENT_COMBO_FLASH]);
+    printWaterStats();
+    printParticleStats();
+
+    if (saveSnapshotPath && !saveWorldSnapshot(&world, saveSnapshotPath)) {
+        printf("Could not save snapshot %s\n", saveSnapshotPath);
+    }
+    bool isExported = !exportFramesPath || stopFrameExport();
+
+    cleanWorld(&world);
+    aFree(&inputs);
+    return isExported ? 0 : 1;
+}
+
+
+////////////////////////////////////////////
+// ..RenderSnapshot
+////////////////////////////////////////////
+
+// Copy of everything drawing needs from a World after a tick. Owned by
+// whichever thread holds its slot, so it can be drawn while the next tick runs.
+typedef struct RenderSnapshot {
+    Array boids;
+    Array boidBombs;
+    Array splashParticles; // Particle
+    Array bloodParticles;  // Particle
+    Array particles;       // Particle, a pool copied out before sorting
+    Snake snake;
+    WaterBody water;
+    float time;
+    unsigned long tick; // ticks simulated before it was captured
+    bool gameHasStarted;
+    Vector2 shakeOffset;
+    float comboFlashPercentage;
+    SpatialGrid boidGrid;            // boids are sorted by it
+    SpatialGrid splashParticleGrid;  // and so on
+    SpatialGrid bloodParticleGrid;
+} RenderSnapshot;
+
+void initRenderSnapshot(RenderSnapshot* snapshot) {
+    *snapshot = (RenderSnapshot){0};
+    snapshot->boids = aCreate(128, sizeof(Boid));
+    snapshot->boidBombs = aCreate(8, sizeof(BoidBomb));
+    snapshot->splashParticles = aCreate(64, sizeof(Particle));
+    snapshot->bloodParticles = aCreate(64, sizeof(Particle));
+    snapshot->particles = aCreate(64, sizeof(Particle));
+    snapshot->snake.nodes = aCreate(SNAKE_NODE_COUNT, sizeof(SnakeNode));
+    snapshot->water.offsets = aCreate(64, sizeof(float));
+    snapshot->water.naturalOffsets = aCreate(64, sizeof(float));
+    snapshot->water.wavePhasors = aCreate(0, sizeof(float));
+    snapshot->water.phasorWaves = aCreate(0, sizeof(WaterWave));
+}
+
+void cleanRenderSnapshot(RenderSnapshot* snapshot) {
+    aFree(&snapshot->boids);
+    aFree(&snapshot->boidBombs);
+    aFree(&snapshot->splashParticles);
+    aFree(&snapshot->bloodParticles);
+    aFree(&snapshot->particles);
+    aFree(&snapshot->snake.nodes);
+    aFree(&snapshot->water.offsets);
+    aFree(&snapshot->water.naturalOffsets);
+    aFree(&snapshot->water.wavePhasors);
+    aFree(&snapshot->water.phasorWaves);
+    spatialGridFree(&snapshot->boidGrid);
+    spatialGridFree(&snapshot->splashParticleGrid);
+    spatialGridFree(&snapshot->bloodParticleGrid);
+}
+
+// Copy an array of items with x, y at positionOffset in grid order.
+void captureSortedItems(Array* to, Array* from, size_t positionOffset, SpatialGrid* grid, Rectangle bounds) {
+    aReserve(to, from->used);
+    to->used = from->used;
+    spatialGridResize(grid, bounds.x, bounds.y, bounds.width, bounds.height, RENDER_GRID_CELL_SIZE);
+    spatialGridSort(grid, from->array, to->array, from->used, from->elementSize, positionOffset);
+}
+
+// Copy an array of entities (or structs starting with one) in grid order.
+void captureSortedEntities(Array* to, Array* from, SpatialGrid* grid, Rectangle bounds) {
+    captureSortedItems(to, from, offsetof(Entity, position), grid, bounds);
+}
+
+// Copy a pool as Particles in grid order, through the scratch array.
+void captureSortedParticles(Array* to, Array* scratch, ParticlePool* pool, SpatialGrid* grid, Rectangle bounds) {
+    aReserve(scratch, pool->count);
+    scratch->used = pool->count;
+    particlePoolCopyOut(pool, scratch->array);
+    captureSortedItems(to, scratch, offsetof(Particle, x), grid, bounds);
+}
+
+void captureRenderSnapshot(RenderSnapshot* snapshot, World* world) {
+    captureSortedEntities(&snapshot->boids, &world->boids, &snapshot->boidGrid, world->bounds);
+    aCopy(&snapshot->boidBombs, &world->boidBombs);
+    captureSortedParticles(&snapshot->splashParticles, &snapshot->particles, &world->splashParticles, &snapshot->splashParticleGrid, world->bounds);
+    captureSortedParticles(&snapshot->bloodParticles, &snapshot->particles, &world->bloodParticles, &snapshot->bloodParticleGrid, world->bounds);
+
+    Array snakeNodes = snapshot->snake.nodes;
+    aCopy(&snakeNodes, &world->snake.nodes);
+    snapshot->snake = world->snake;
+    snapshot->snake.nodes = snakeNodes;
+
+    aCopy(&snapshot->water.offsets, &world->water.offsets);
+    snapshot->water.bounds = world->water.bounds;
+    updateWaterWaves(&snapshot->water, &world->waves, world->time);
+
+    snapshot->time = world->time;
+    snapshot->gameHasStarted = world->gameHasStarted;
+    snapshot->shakeOffset = world->shakeOffset;
+    snapshot->comboFlashPercentage = world->comboFlashPercentage;
+}
+
+
+////////////////////////////////////////////
+// ..RenderSystems
+////////////////////////////////////////////
+
+// Each render system records its own RenderList from the frame's snapshot,
+// which they only read. They run as one job per system on renderJobSystem,
+// which has its own workers since the simulation thread keeps running graphs
+// on jobSystem in the meantime.
+
+typedef enum RenderSystem {
+    RENDER_SYSTEM_HUD,
+    RENDER_SYSTEM_BLOOD_PARTICLES,
+    RENDER_SYSTEM_BOIDS,
+    RENDER_SYSTEM_WATER,
+    RENDER_SYSTEM_BOID_BOMBS,
+    RENDER_SYSTEM_SNAKE,
+    RENDER_SYSTEM_SPLASH_PARTICLES,
+    RENDER_SYSTEM_COUNT,
+} RenderSystem;
+
+typedef struct FrameRender {
+    RenderSnapshot* frame;
+    float alpha;
+    float renderTime;
+    Rectangle view;
+    CullStats cullStats[RENDER_SYSTEM_COUNT]; // each only written by its system
+    RenderTexture2D comboTexture;
+    RenderList lists[RENDER_SYSTEM_COUNT];
+    RenderQueue queue;
+} FrameRender;
+
+JobSystem renderJobSystem;
+
+// The combo text is only drawn into its texture again when the string or
+// its size change. The size is quantized so the flash animation doesn't
+// redraw it every frame. Only touched by hudRender.
+#define COMBO_TEXT_SIZE_STEP 4
+
+typedef struct HudTexts {
+    CachedText combo; // what comboTexture holds
+    CachedText score;
+    CachedText move;
+    CachedText dash;
+    unsigned long comboRenders;
+} HudTexts;
+
+HudTexts hudTexts = {0};
+
+void hudRender(RenderList* list, RenderSnapshot* frame, RenderTexture2D comboTexture) {
+    char str[RENDER_TEXT_MAX];
+    Vector2 comboTextureSize = {comboTexture.texture.width, comboTexture.texture.height};
+
+    if (frame->gameHasStarted) {
+        sprintf(str, "x%d", (int) getComboBonus(frame->snake.comboLevel));
+        Vector2 drawPosition = RectangleCenter(frame->water.bounds);
+        drawPosition.y += 60;
+
+        float cutoff = frame->snake.comboLevel - floor(frame->snake.comboLevel);
+        float colorBonus = frame->snake.comboHealth;
+
+        Vector2 scale = getSquashScale((1.0 - frame->comboFlashPercentage) * 0.5, 1.05);
+        int fontSize = roundf(200 * scale.x / COMBO_TEXT_SIZE_STEP) * COMBO_TEXT_SIZE_STEP;
+        if (updateCachedText(&hudTexts.combo, &MAIN_FONT, str, fontSize, 0.0)) {
+            recordText(list, RENDER_TARGET_COMBO, LAYER_COMBO, Vector2Scale(comboTextureSize, 0.5), (Vector2){0.5, 0.5}, &hudTexts.combo, WHITE);
+            hudTexts.comboRenders++;
+        }
+        Vector2 textSize = hudTexts.combo.size;
+        float half = (1.0 - (textSize.y / comboTextureSize.y)) / 2.0;
+        cutoff = Remap(cutoff, 0.0, 1.0, half + 0.1, 1.0 - half - 0.15);
+
+        GLSLColor color2 = glslColor(ColorLerp(ColorLerp(COLOR_BG, COLOR_MAIN, 0.1 + colorBonus * 0.1), COLOR_MAIN, frame->comboFlashPercentage));
+        GLSLColor color1 = glslColor(ColorLerp(ColorLerp(COLOR_BG, COLOR_MAIN, 0.2 + colorBonus * 0.1), COLOR_MAIN, frame->comboFlashPercentage));
+        color1.a = Lerp(0.1, 1.0, frame->snake.comboHealth);
+        color2.a = color1.a;
+
+        Rectangle source = { 0, 0, comboTextureSize.x, -comboTextureSize.y };
+        Vector2 position = Vector2Add(Vector2Subtract(drawPosition, Vector2Multiply(comboTextureSize, (Vector2){0.5, 1.0})), ((Vector2){0, 40}));
+        recordMaskedTexture(list, LAYER_COMBO, comboTexture.texture, source, position, cutoff, color1, color2);
+
+        sprintf(str, "%d", (int) floor(frame->snake.score));
+        updateCachedText(&hudTexts.score, &MAIN_FONT, str, 50, 0.0);
+        recordText(list, RENDER_TARGET_SCREEN, LAYER_HUD, drawPosition, (Vector2){0.5, 0.0}, &hudTexts.score, ColorLerp(COLOR_BG, COLOR_MAIN, 0.1));
+    } else {
+        Vector2 drawPosition = RectangleCenter(frame->water.bounds);
+        updateCachedText(&hudTexts.move, &MAIN_FONT, "[WASD] to Move.", 50, 0.0);
+        updateCachedText(&hudTexts.dash, &MAIN_FONT, "[Space] to Dash.", 50, 0.0);
+        recordText(list, RENDER_TARGET_SCREEN, LAYER_HUD, drawPosition, (Vector2){0.5, 1.0}, &hudTexts.move, ColorLerp(COLOR_BG, COLOR_MAIN, 0.3));
+        recordText(list, RENDER_TARGET_SCREEN, LAYER_HUD, drawPosition, (Vector2){0.5, 0.0}, &hudTexts.dash, ColorLerp(COLOR_BG, COLOR_MAIN, 0.3));
+    }
+}
+
+void renderSystemsJob(void* data, unsigned int start, unsigned int end) {
+    FrameRender* render = data;
+    RenderSnapshot* frame = render->frame;
+
+    for (unsigned int i = start; i < end; i++) {
+        RenderList* list = &render->lists[i];
+        clearRenderList(list);
+        switch (i) {
+            case RENDER_SYSTEM_HUD:                 hudRender(list, frame, render->comboTexture); break;
+            case RENDER_SYSTEM_BLOOD_PARTICLES:     bloodParticlesRender(list, &frame->bloodParticles, &frame->bloodParticleGrid, render->view, render->alpha, &render->cullStats[i]); break;
+            case RENDER_SYSTEM_BOIDS:               boidsRender(list, &frame->boids, &frame->boidGrid, render->view, render->alpha, &render->cullStats[i]); break;
+            case RENDER_SYSTEM_WATER:               waterBodyRender(list, &frame->water); break;
+            case RENDER_SYSTEM_BOID_BOMBS:          boidBombsRender(list, &frame->boidBombs, render->renderTime, render->alpha); break;
+            case RENDER_SYSTEM_SNAKE:               snakeRender(list, &frame->snake, render->renderTime, render->alpha); break;
+            case RENDER_SYSTEM_SPLASH_PARTICLES:    splashParticlesRender(list, &frame->splashParticles, &frame->splashParticleGrid, render->view, render->alpha, &render->cullStats[i]); break;
+        }
+    }
+}
+
+void initFrameRender(FrameRender* render, RenderTexture2D comboTexture) {
+    *render = (FrameRender){0};
+    render->comboTexture = comboTexture;
+    for ITERATE(i, RENDER_SYSTEM_COUNT) {
+        initRenderList(&render->lists[i]);
+    }
+    render->queue.entries = aCreate(256, sizeof(RenderQueueEntry));
+}
+
+void cleanFrameRender(FrameRender* render) {
+    for ITERATE(i, RENDER_SYSTEM_COUNT) {
+        cleanRenderList(&render->lists[i]);
+    }
+    aFree(&render->queue.entries);
+}
+
+// Record every render system for frame and sort the commands into
+// render->queue, ready for executeRenderQueue.
+void recordFrame(FrameRender* render, RenderSnapshot* frame, Rectangle view, float alpha, float renderTime) {
+    render->frame = frame;
+    render->view = view;
+    render->alpha = alpha;
+    render->renderTime = renderTime;
+
+    JobGraph graph;
+    jobGraphClear(&graph);
+    jobGraphAdd(&graph, "renderSystems", renderSystemsJob, render, RENDER_SYSTEM_COUNT, 1, 0, 0);
+    jobGraphRun(&renderJobSystem, &graph);
+
+    buildRenderQueue(&render->queue, render->lists, RENDER_SYSTEM_COUNT);
+}
+
+
+////////////////////////////////////////////
+// ..SoftwareRender
+////////////////////////////////////////////
+
+// CPU backend for the RenderQueue executeRenderQueue draws: the same sorted
+// commands, rasterized into RGBA framebuffers in memory. It runs without a
+// GPU, so frames can be benchmarked, compared and exported on servers.
+//
+// Each target is split into tiles of SOFTWARE_TILE_SIZE pixels. The queue is
+// binned serially, every command (every instance for geometry) going to the
+// tiles its bounds touch, then the tiles are rasterized as jobs on
+// renderJobSystem. A tile only writes its own pixels and draws its items in
+// queue order, so the result doesn't depend on the worker count.
+//
+// It follows the GPU path closely but not exactly: capsules get the same one
+// pixel smoothstep edge as capsule.fs, textures are sampled nearest, and
+// blending is GL's SRC_ALPHA, ONE_MINUS_SRC_ALPHA, alpha included.
+
+#define SOFTWARE_TILE_SIZE 64
+
+typedef struct SoftwareFramebuffer {
+    int width;
+    int height;
+    Color* pixels; // rows top to bottom
+} SoftwareFramebuffer;
+
+typedef struct SoftwareItem {
+    RenderCommand* command;
+    size_t instance; // geometry: index in the command's batch
+} SoftwareItem;
+
+typedef struct SoftwareTile {
+    int x0, y0, x1, y1; // pixels [x0, x1) x [y0, y1)
+    Array items;        // SoftwareItem, in queue order
+} SoftwareTile;
+
+typedef struct SoftwareRenderer {
+    SoftwareFramebuffer targets[RENDER_TARGET_COUNT];
+    SoftwareTile* tiles;
+    size_t tileCapacity;
+    size_t tileCount;
+    int tileColumns;
+    RenderTarget target; // being drawn
+    Color clearColor;
+    Camera2D camera;
+    JobSystem* jobs;
+    unsigned long frames;
+    double binSeconds;
+    double rasterSeconds;
+} SoftwareRenderer;
+
+void initSoftwareFramebuffer(SoftwareFramebuffer* framebuffer, int width, int height) {
+    framebuffer->width = width;
+    framebuffer->height = height;
+    framebuffer->pixels = calloc((size_t) width * height, sizeof(Color));
+}
+
+// Shares the pixels, for ExportImage and UpdateTexture.
+Image getSoftwareImage(SoftwareFramebuffer* framebuffer) {
+    return (Image){framebuffer->pixels, framebuffer->width, framebuffer->height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+}
+
+size_t getSoftwareTileCount(SoftwareFramebuffer* framebuffer) {
+    return (size_t) ((framebuffer->width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE)
+        * ((framebuffer->height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE);
+}
+
+void initSoftwareRenderer(SoftwareRenderer* renderer, Vector2 screenSize, Vector2 comboSize, JobSystem* jobs) {
+    *renderer = (SoftwareRenderer){0};
+    renderer->jobs = jobs;
+    initSoftwareFramebuffer(&renderer->targets[RENDER_TARGET_SCREEN], screenSize.x, screenSize.y);
+    initSoftwareFramebuffer(&renderer->targets[RENDER_TARGET_COMBO], comboSize.x, comboSize.y);
+
+    for ITERATE(i, RENDER_TARGET_COUNT) {
+        renderer->tileCapacity = fmax(renderer->tileCapacity, getSoftwareTileCount(&renderer->targets[i]));
+    }
+    renderer->tiles = calloc(renderer->tileCapacity, sizeof(SoftwareTile));
+    for ITERATE(i, renderer->tileCapacity) {
+        renderer->tiles[i].items = aCreate(64, sizeof(SoftwareItem));
+    }
+}
+
+void cleanSoftwareRenderer(SoftwareRenderer* renderer) {
+    for ITERATE(i, RENDER_TARGET_COUNT) {
+        free(renderer->targets[i].pixels);
+    }
+    for ITERATE(i, renderer->tileCapacity) {
+        aFree(&renderer->tiles[i].items);
+    }
+    free(renderer->tiles);
+}
+
+// Like the camera of BeginMode2D, which is never rotated. Other targets are
+// drawn in their own pixels.
+Vector2 softwareToTarget(SoftwareRenderer* renderer, Vector2 position) {
+    if (renderer->target != RENDER_TARGET_SCREEN) return position;
+    return Vector2Add(Vector2Scale(Vector2Subtract(position, renderer->camera.target), renderer->camera.zoom), renderer->camera.offset);
+}
+
+Vector2 softwareFromTarget(SoftwareRenderer* renderer, Vector2 position) {
+    if (renderer->target != RENDER_TARGET_SCREEN) return position;
+    return Vector2Add(Vector2Scale(Vector2Subtract(position, renderer->camera.offset), 1.0 / renderer->camera.zoom), renderer->camera.target);
+}
+
+float softwareScale(SoftwareRenderer* renderer) {
+    return renderer->target == RENDER_TARGET_SCREEN ? renderer->camera.zoom : 1.0;
+}
+
+void softwareBlend(Color* pixel, Color color, float coverage) {
+    float alpha = color.a / 255.0f * coverage;
+    if (alpha <= 0) return;
+    float keep = 1.0f - alpha;
+    pixel->r = color.r * alpha + pixel->r * keep + 0.5f;
+    pixel->g = color.g * alpha + pixel->g * keep + 0.5f;
+    pixel->b = color.b * alpha + pixel->b * keep + 0.5f;
+    pixel->a = color.a * alpha + pixel->a * keep + 0.5f;
+}
+
+Color softwareTint(Color texel, Color tint) {
+    return (Color){texel.r * tint.r / 255, texel.g * tint.g / 255, texel.b * tint.b / 255, texel.a * tint.a / 255};
+}
+
+// Quad of DrawTexturePro: dest is where origin lands, rotated around it by
+// rotation degrees. A negative source width or height flips it.
+typedef struct SoftwareQuad {
+    Rectangle source;
+    Rectangle dest;
+    Vector2 origin;
+    float rotation;
+} SoftwareQuad;
+
+SoftwareQuad getSpriteQuad(RenderCommand* command) {
+    Vector2 scale = command->sprite.scale;
+    Vector2 anchor = command->sprite.anchor;
+    if (scale.x < 0) anchor.x = 1.0 - anchor.x;
+    if (scale.y < 0) anchor.y = 1.0 - anchor.y;
+
+    Rectangle source = command->sprite.sprite.source;
+    Vector2 size = {source.width * fabs(scale.x), source.height * fabs(scale.y)};
+    return (SoftwareQuad){
+        {source.x, source.y, source.width * fsign(scale.x), source.height * fsign(scale.y)},
+        {command->sprite.position.x, command->sprite.position.y, size.x, size.y},
+        Vector2Multiply(anchor, size),
+        command->sprite.rotation,
+    };
+}
+
+Vector2 getTextStart(RenderCommand* command) {
+    return Vector2Subtract(command->text.position, Vector2Multiply(command->text.size, command->text.anchor));
+}
+
+// Bounds in target pixels, the edge pixel included.
+Rectangle getSoftwareQuadBounds(SoftwareRenderer* renderer, SoftwareQuad quad) {
+    float radians = quad.rotation * DEG2RAD;
+    Vector2 corners[4] = {
+        {-quad.origin.x, -quad.origin.y},
+        {quad.dest.width - quad.origin.x, -quad.origin.y},
+        {-quad.origin.x, quad.dest.height - quad.origin.y},
+        {quad.dest.width - quad.origin.x, quad.dest.height - quad.origin.y},
+    };
+    Vector2 low = {INFINITY, INFINITY};
+    Vector2 high = {-INFINITY, -INFINITY};
+    for ITERATE(i, 4) {
+        Vector2 corner = softwareToTarget(renderer, Vector2Add((Vector2){quad.dest.x, quad.dest.y}, Vector2Rotate(corners[i], radians)));
+        low = Vector2Min(low, corner);
+        high = Vector2Max(high, corner);
+    }
+    return (Rectangle){low.x - 1, low.y - 1, high.x - low.x + 2, high.y - low.y + 2};
+}
+
+Rectangle getSoftwareItemBounds(SoftwareRenderer* renderer, SoftwareItem item) {
+    RenderCommand* command = item.command;
+    switch (command->primitive) {
+        case RENDER_GEOMETRY: {
+            GeometryInstance* instance = &command->geometry.batch->instances[item.instance];
+            Vector2 center = softwareToTarget(renderer, (Vector2){instance->x, instance->y});
+            float scale = softwareScale(renderer);
+            Vector2 extent = Vector2AddValue(Vector2Scale((Vector2){fabs(instance->axisX), fabs(instance->axisY)}, scale), instance->radius * scale + 1);
+            return (Rectangle){center.x - extent.x, center.y - extent.y, extent.x * 2, extent.y * 2};
+        }
+        case RENDER_SPRITE:
+            return getSoftwareQuadBounds(renderer, getSpriteQuad(command));
+        case RENDER_TEXT: {
+            // Glyph quads reach past the measured size by their padding.
+            float padding = command->text.font->glyphPadding * command->text.fontSize / (float) command->text.font->baseSize;
+            Vector2 start = getTextStart(command);
+            return getSoftwareQuadBounds(renderer, (SoftwareQuad){
+                {0}, {start.x - padding, start.y - padding, command->text.size.x + padding * 2, command->text.size.y + padding * 2}});
+        }
+        case RENDER_MASKED_TEXTURE: {
+            Rectangle source = command->masked.source;
+            return getSoftwareQuadBounds(renderer, (SoftwareQuad){
+                {0}, {command->masked.position.x, command->masked.position.y, fabs(source.width), fabs(source.height)}});
+        }
+    }
+    return (Rectangle){0};
+}
+
+void binSoftwareItem(SoftwareRenderer* renderer, SoftwareItem item) {
+    SoftwareFramebuffer* framebuffer = &renderer->targets[renderer->target];
+    Rectangle bounds = getSoftwareItemBounds(renderer, item);
+    if (bounds.x >= framebuffer->width || bounds.y >= framebuffer->height
+        || bounds.x + bounds.width <= 0 || bounds.y + bounds.height <= 0) return;
+
+    int tileRows = renderer->tileCount / renderer->tileColumns;
+    int firstColumn = fmax(0, floor(bounds.x / SOFTWARE_TILE_SIZE));
+    int lastColumn = fmin(renderer->tileColumns - 1, floor((bounds.x + bounds.width) / SOFTWARE_TILE_SIZE));
+    int firstRow = fmax(0, floor(bounds.y / SOFTWARE_TILE_SIZE));
+    int lastRow = fmin(tileRows - 1, floor((bounds.y + bounds.height) / SOFTWARE_TILE_SIZE));
+    for (int row = firstRow; row <= lastRow; row++)
+    for (int column = firstColumn; column <= lastColumn; column++) {
+        aAppend(&renderer->tiles[row * renderer->tileColumns + column].items, &item);
+    }
+}
+
+void softwareDrawCapsule(SoftwareRenderer* renderer, SoftwareFramebuffer* framebuffer, SoftwareTile* tile, GeometryInstance* instance) {
+    float scale = softwareScale(renderer);
+    Vector2 center = softwareToTarget(renderer, (Vector2){instance->x, instance->y});
+    Vector2 axis = {instance->axisX * scale, instance->axisY * scale};
+    float radius = instance->radius * scale;
+    float axisLengthSquared = Vector2LengthSqr(axis);
+    Color color;
+    memcpy(&color, &instance->color, sizeof(color));
+
+    Vector2 extent = Vector2AddValue((Vector2){fabs(axis.x), fabs(axis.y)}, radius + 1);
+    int x0 = fmax(tile->x0, floor(center.x - extent.x));
+    int x1 = fmin(tile->x1, ceil(center.x + extent.x));
+    int y0 = fmax(tile->y0, floor(center.y - extent.y));
+    int y1 = fmin(tile->y1, ceil(center.y + extent.y));
+
+    for (int y = y0; y < y1; y++) {
+        Color* row = &framebuffer->pixels[(size_t) y * framebuffer->width];
+        for (int x = x0; x < x1; x++) {
+            Vector2 offset = {x + 0.5f - center.x, y + 0.5f - center.y};
+            float along = axisLengthSquared > 0 ? Clamp(Vector2DotProduct(offset, axis) / axisLengthSquared, -1, 1) : 0;
+            float distance = Vector2Length(Vector2Subtract(offset, Vector2Scale(axis, along)));
+            if (distance >= radius) continue;
+            float edge = Clamp(distance - (radius - 1), 0, 1);
+            softwareBlend(&row[x], color, 1.0f - edge * edge * (3.0f - 2.0f * edge)); // 1 - smoothstep
+        }
+    }
+}
+
+// Nearest sampled, texels tinted by tint.
+void softwareDrawQuad(SoftwareRenderer* renderer, SoftwareFramebuffer* framebuffer, SoftwareTile* tile, Image* image, SoftwareQuad quad, Color tint) {
+    assert(image->format == PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    if (quad.dest.width <= 0 || quad.dest.height <= 0) return;
+    Rectangle bounds = getSoftwareQuadBounds(renderer, quad);
+    int x0 = fmax(tile->x0, floor(bounds.x));
+    int x1 = fmin(tile->x1, ceil(bounds.x + bounds.width));
+    int y0 = fmax(tile->y0, floor(bounds.y));
+    int y1 = fmin(tile->y1, ceil(bounds.y + bounds.height));
+
+    bool flipX = quad.source.width < 0;
+    bool flipY = quad.source.height < 0;
+    Rectangle source = {quad.source.x, quad.source.y, fabs(quad.source.width), fabs(quad.source.height)};
+    float radians = -quad.rotation * DEG2RAD;
+    Color* texels = image->data;
+
+    for (int y = y0; y < y1; y++) {
+        Color* row = &framebuffer->pixels[(size_t) y * framebuffer->width];
+        for (int x = x0; x < x1; x++) {
+            Vector2 position = softwareFromTarget(renderer, (Vector2){x + 0.5f, y + 0.5f});
+            Vector2 local = Vector2Add(Vector2Rotate(Vector2Subtract(position, (Vector2){quad.dest.x, quad.dest.y}), radians), quad.origin);
+            if (local.x < 0 || local.y < 0 || local.x >= quad.dest.width || local.y >= quad.dest.height) continue;
+
+            float u = local.x / quad.dest.width;
+            float v = local.y / quad.dest.height;
+            if (flipX) u = 1.0f - u;
+            if (flipY) v = 1.0f - v;
+            int texelX = Clamp(floorf(source.x + u * source.width), 0, image->width - 1);
+            int texelY = Clamp(floorf(source.y + v * source.height), 0, image->height - 1);
+            softwareBlend(&row[x], softwareTint(texels[(size_t) texelY * image->width + texelX], tint), 1.0f);
+        }
+    }
+}
+
+// Glyph by glyph, laid out like DrawTextEx on a single line.
+void softwareDrawText(SoftwareRenderer* renderer, SoftwareFramebuffer* framebuffer, SoftwareTile* tile, RenderCommand* command) {
+    Font* font = command->text.font;
+    assert(font == &MAIN_FONT);
+    float scale = command->text.fontSize / (float) font->baseSize;
+    float padding = font->glyphPadding;
+    Vector2 position = getTextStart(command);
+
+    for (const char* c = command->text.text; *c; c++) {
+        int index = GetGlyphIndex(*font, *c);
+        GlyphInfo* glyph = &font->glyphs[index];
+        Rectangle rec = font->recs[index];
+        if (*c != ' ' && *c != '\t') {
+            SoftwareQuad quad = {
+                {rec.x - padding, rec.y - padding, rec.width + padding * 2, rec.height + padding * 2},
+                {position.x + (glyph->offsetX - padding) * scale, position.y + (glyph->offsetY - padding) * scale,
+                    (rec.width + padding * 2) * scale, (rec.height + padding * 2) * scale},
+            };
+            softwareDrawQuad(renderer, framebuffer, tile, &MAIN_FONT_IMAGE, quad, command->text.color);
+        }
+        position.x += (glyph->advanceX ? glyph->advanceX : rec.width) * scale + command->text.spacing;
+    }
+}
+
+// Like mask.fs over the combo target: color1 below the cutoff, color2 above
+// it, with the texel's alpha. GL render textures are stored bottom up, which
+// the negative source height flips back; the framebuffer already is upright.
+void softwareDrawMaskedTexture(SoftwareRenderer* renderer, SoftwareFramebuffer* framebuffer, SoftwareTile* tile, RenderCommand* command) {
+    SoftwareFramebuffer* combo = &renderer->targets[RENDER_TARGET_COMBO];
+    assert(renderer->target == RENDER_TARGET_SCREEN);
+    Image image = getSoftwareImage(combo);
+    SoftwareQuad quad = {command->masked.source};
+    quad.source.height = fabs(quad.source.height);
+    quad.dest = (Rectangle){command->masked.position.x, command->masked.position.y, quad.source.width, quad.source.height};
+
+    Rectangle bounds = getSoftwareQuadBounds(renderer, quad);
+    int x0 = fmax(tile->x0, floor(bounds.x));
+    int x1 = fmin(tile->x1, ceil(bounds.x + bounds.width));
+    int y0 = fmax(tile->y0, floor(bounds.y));
+    int y1 = fmin(tile->y1, ceil(bounds.y + bounds.height));
+
+    GLSLColor colors[2] = {command->masked.color1, command->masked.color2};
+    for (int y = y0; y < y1; y++) {
+        Color* row = &framebuffer->pixels[(size_t) y * framebuffer->width];
+        for (int x = x0; x < x1; x++) {
+            Vector2 local = Vector2Subtract(softwareFromTarget(renderer, (Vector2){x + 0.5f, y + 0.5f}), command->masked.position);
+            if (local.x < 0 || local.y < 0 || local.x >= quad.dest.width || local.y >= quad.dest.height) continue;
+
+            int texelX = Clamp(floorf(quad.source.x + local.x), 0, image.width - 1);
+            int texelY = Clamp(floorf(quad.source.y + local.y), 0, image.height - 1);
+            float texcoordY = 1.0f - local.y / quad.dest.height;
+            GLSLColor color = colors[texcoordY < command->masked.cutoff ? 0 : 1];
+            float alpha = color.a * combo->pixels[(size_t) texelY * image.width + texelX].a;
+            softwareBlend(&row[x], (Color){color.r * 255, color.g * 255, color.b * 255, alpha}, 1.0f);
+        }
+    }
+}
+
+void softwareTilesJob(void* data, unsigned int start, unsigned int end) {
+    SoftwareRenderer* renderer = data;
+    SoftwareFramebuffer* framebuffer = &renderer->targets[renderer->target];
+
+    for (unsigned int i = start; i < end; i++) {
+        SoftwareTile* tile = &renderer->tiles[i];
+        for (int y = tile->y0; y < tile->y1; y++) {
+            Color* row = &framebuffer->pixels[(size_t) y * framebuffer->width];
+            for (int x = tile->x0; x < tile->x1; x++) row[x] = renderer->clearColor;
+        }
+
+        for ITERATE(j, tile->items.used) {
+            SoftwareItem* item = aGet(&tile->items, j);
+            RenderCommand* command = item->command;
+            switch (command->primitive) {
+                case RENDER_GEOMETRY:
+                    softwareDrawCapsule(renderer, framebuffer, tile, &command->geometry.batch->instances[item->instance]);
+                    break;
+                case RENDER_SPRITE:
+                    assert(command->sprite.sprite.texture.id == SPRITE_ATLAS.id);
+                    softwareDrawQuad(renderer, framebuffer, tile, &SPRITE_ATLAS_IMAGE, getSpriteQuad(command), command->sprite.tint);
+                    break;
+                case RENDER_TEXT:
+                    softwareDrawText(renderer, framebuffer, tile, command);
+                    break;
+                case RENDER_MASKED_TEXTURE:
+                    softwareDrawMaskedTexture(renderer, framebuffer, tile, command);
+                    break;
+            }
+        }
+    }
+}
+
+// Clear target and draw its commands, queue entries [first, end).
+void softwareRenderTarget(SoftwareRenderer* renderer, RenderQueue* queue, RenderTarget target, size_t first, size_t end) {
+    SoftwareFramebuffer* framebuffer = &renderer->targets[target];
+    renderer->target = target;
+    renderer->tileColumns = (framebuffer->width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+    renderer->tileCount = getSoftwareTileCount(framebuffer);
+    assert(renderer->tileCount <= renderer->tileCapacity);
+
+    double startTime = getSeconds();
+    for ITERATE(i, renderer->tileCount) {
+        SoftwareTile* tile = &renderer->tiles[i];
+        tile->x0 = (i % renderer->tileColumns) * SOFTWARE_TILE_SIZE;
+        tile->y0 = (i / renderer->tileColumns) * SOFTWARE_TILE_SIZE;
+        tile->x1 = fmin(tile->x0 + SOFTWARE_TILE_SIZE, framebuffer->width);
+        tile->y1 = fmin(tile->y0 + SOFTWARE_TILE_SIZE, framebuffer->height);
+        tile->items.used = 0;
+    }
+
+    for (size_t i = first; i < end; i++) {
+        RenderCommand* command = ((RenderQueueEntry*) aGet(&queue->entries, i))->command;
+        if (command->primitive != RENDER_GEOMETRY) {
+            binSoftwareItem(renderer, (SoftwareItem){command, 0});
+            continue;
+        }
+        for ITERATE(j, command->geometry.count) {
+            binSoftwareItem(renderer, (SoftwareItem){command, command->geometry.first + j});
+        }
+    }
+    double binnedTime = getSeconds();
+
+    JobGraph graph;
+    jobGraphClear(&graph);
+    jobGraphAdd(&graph, "softwareTiles", softwareTilesJob, renderer, renderer->tileCount, 1, 0, 0);
+    jobGraphRun(renderer->jobs, &graph);
+
+    renderer->binSeconds += binnedTime - startTime;
+    renderer->rasterSeconds += getSeconds() - binnedTime;
+}
+
+// Software executeRenderQueue. The screen starts as background. Like the
+// combo render texture, the combo framebuffer keeps its pixels on frames
+// that don't draw into it.
+void softwareExecuteRenderQueue(SoftwareRenderer* renderer, RenderQueue* queue, Camera2D camera, Color background) {
+    renderer->camera = camera;
+
+    // Sorted by target first, so each target is one run of the queue.
+    size_t first = 0;
+    for (RenderTarget target = 0; target < RENDER_TARGET_COUNT; target++) {
+        size_t end = first;
+        while (end < queue->entries.used && ((RenderQueueEntry*) aGet(&queue->entries, end))->command->target == target) end++;
+
+        if (target == RENDER_TARGET_SCREEN) {
+            renderer->clearColor = background;
+            softwareRenderTarget(renderer, queue, target, first, end);
+        } else if (end > first) {
+            renderer->clearColor = (Color){0};
+            softwareRenderTarget(renderer, queue, target, first, end);
+        }
+        first = end;
+    }
+    renderer->frames++;
+}
+
+void printSoftwareRenderStats(SoftwareRenderer* renderer) {
+    if (!renderer->frames) return;
+    printf("Software render on %u workers, %dx%d tiles: %.3f ms per frame binning, %.3f ms rasterizing\n",
+        renderer->jobs->workerCount, SOFTWARE_TILE_SIZE, SOFTWARE_TILE_SIZE,
+        renderer->binSeconds / renderer->frames * 1000, renderer->rasterSeconds / renderer->frames * 1000);
+}
+
+// With --export-frames, runReplay renders the world after every tick and
+// writes it to <directory>/frame_NNNNN.png. No window is opened.
+typedef struct FrameExport {
+    const char* directory;
+    RenderSnapshot snapshot;
+    FrameRender render;
+    SoftwareRenderer renderer;
+    unsigned long frames;
+    unsigned long failures;
+    double renderSeconds;
+    double writeSeconds;
+} FrameExport;
+
+FrameExport frameExport = {0};
+
+void startFrameExport(const char* directory) {
+    loadAssets(false, true);
+    frameExport.directory = directory;
+    initRenderSnapshot(&frameExport.snapshot);
+    Vector2 comboSize = COMBO_TEXTURE_SIZE;
+    initFrameRender(&frameExport.render, (RenderTexture2D){.texture = {0, comboSize.x, comboSize.y, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8}});
+    initSoftwareRenderer(&frameExport.renderer, SCREEN_SIZE, comboSize, &renderJobSystem);
+}
+
+// The world as of its last tick, not interpolated.
+void exportFrame(World* world) {
+    double startTime = getSeconds();
+    captureRenderSnapshot(&frameExport.snapshot, world);
+    setPalette(frameExport.snapshot.snake.comboLevel);
+    Camera2D exportCamera = {.target = frameExport.snapshot.shakeOffset, .zoom = 1.0};
+    recordFrame(&frameExport.render, &frameExport.snapshot, getCameraView(exportCamera, SCREEN_SIZE), 1.0, frameExport.snapshot.time);
+    softwareExecuteRenderQueue(&frameExport.renderer, &frameExport.render.queue, exportCamera, COLOR_BG);
+    double renderedTime = getSeconds();
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/frame_%05lu.png", frameExport.directory, frameExport.frames);
+    if (!ExportImage(getSoftwareImage(&frameExport.renderer.targets[RENDER_TARGET_SCREEN]), path)) frameExport.failures++;
+    frameExport.frames++;
+    frameExport.renderSeconds += renderedTime - startTime;
+    frameExport.writeSeconds += getSeconds() - renderedTime;
+}
+
+// Returns false when a frame couldn't be written.
+bool stopFrameExport() {
+    unsigned long frames = fmax(frameExport.frames, 1);
+    printf("Exported %lu frames to %s, %lu failed: %.3f ms per frame rendering, %.3f ms writing\n",
+        frameExport.frames, frameExport.directory, frameExport.failures,
+        frameExport.renderSeconds / frames * 1000, frameExport.writeSeconds / frames * 1000);
+    if (DEBUG_ENABLED) printSoftwareRenderStats(&frameExport.renderer);
+
+    cleanSoftwareRenderer(&frameExport.renderer);
+    cleanFrameRender(&frameExport.render);
+    cleanRenderSnapshot(&frameExport.snapshot);
+    return frameExport.failures == 0;
+}
+
+
+////////////////////////////////////////////
+// ..SimThread
+////////////////////////////////////////////
+
+// Runs worldUpdate on its own thread. The main thread asks for ticks with
+// requestSimTicks and draws one tick behind them: between T-1 and T, which
+// snapshot T carries, while the sim computes T+1. So tick N+1 is simulated
+// while frame N is drawn, and the main thread never waits on the sim.
+typedef struct SimThread {
+    pthread_t thread;
+    World* world;
+    InputRecorder* recorder;
+    EventSink eventSink;
+    unsigned long tick; // owned by the sim thread, stamped on snapshots
+
+    TripleBuffer snapshots;
+    RenderSnapshot snapshotSlots[3];
+
+    // Guarded by mutex.
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    unsigned int pendingTicks;
+    InputFrame input; // dash stays latched until a tick consumes it
+    bool shouldStop;
+} SimThread;
+
+void* simThreadRun(void* data) {
+    SimThread* sim = data;
+
+    pthread_mutex_lock(&sim->mutex);
+    while (true) {
+        while (!sim->pendingTicks && !sim->shouldStop) {
+            pthread_cond_wait(&sim->wake, &sim->mutex);
+        }
+        if (sim->shouldStop) break;
+
+        sim->pendingTicks--;
+        InputFrame input = sim->input;
+        sim->input.buttons &= ~INPUT_DASH;
+        pthread_mutex_unlock(&sim->mutex);
+
+        recordInput(sim->recorder, input);
+        worldUpdate(sim->world, input, FIXED_DELTA);
+        applySimEvents(sim->world, &sim->eventSink);
+
+        RenderSnapshot* snapshot = &sim->snapshotSlots[tbWriteIndex(&sim->snapshots)];
+        captureRenderSnapshot(snapshot, sim->world);
+        snapshot->tick = ++sim->tick;
+        tbPublish(&sim->snapshots);
+
+        pthread_mutex_lock(&sim->mutex);
+    }
+    pthread_mutex_unlock(&sim->mutex);
+    return NULL;
+}
+
+void startSimThread(SimThread* sim, World* world, InputRecorder* recorder) {
+    sim->world = world;
+    sim->recorder = recorder;
+    sim->eventSink = (EventSink){0};
+    sim->tick = 0;
+    sim->pendingTicks = 0;
+    sim->input = (InputFrame){0};
+    sim->shouldStop = false;
+
+    tbInit(&sim->snapshots);
+    for ITERATE(i, 3) {
+        initRenderSnapshot(&sim->snapshotSlots[i]);
+    }
+
+    // Publish the starting state so there's something to draw before the first tick.
+    captureRenderSnapshot(&sim->snapshotSlots[tbWriteIndex(&sim->snapshots)], world);
+    sim->snapshotSlots[tbWriteIndex(&sim->snapshots)].tick = 0;
+    tbPublish(&sim->snapshots);
+    tbAcquire(&sim->snapshots);
+
+    pthread_mutex_init(&sim->mutex, NULL);
+    pthread_cond_init(&sim->wake, NULL);
+    pthread_create(&sim->thread, NULL, simThreadRun, sim);
+}
+
+// Wait for the simulation to finish its current tick and stop. Ticks still
+// pending are dropped. The world is safe to touch again afterwards.
+void stopSimThread(SimThread* sim) {
+    pthread_mutex_lock(&sim->mutex);
+    sim->shouldStop = true;
+    pthread_cond_signal(&sim->wake);
+    pthread_mutex_unlock(&sim->mutex);
+
+    pthread_join(sim->thread, NULL);
+    pthread_cond_destroy(&sim->wake);
+    pthread_mutex_destroy(&sim->mutex);
+
+    for ITERATE(i, 3) {
+        cleanRenderSnapshot(&sim->snapshotSlots[i]);
+    }
+}
+
+// Queue tickCount more ticks. The caller caps tickCount, every requested
+// tick runs.
+void requestSimTicks(SimThread* sim, InputFrame input, unsigned int tickCount) {
+    pthread_mutex_lock(&sim->mutex);
+    sim->input.buttons = (sim->input.buttons & INPUT_DASH) | input.buttons;
+    sim->pendingTicks += tickCount;
+    pthread_cond_signal(&sim->wake);
+    pthread_mutex_unlock(&sim->mutex);
+}
+
+// Snapshot to draw tick (T) from. The one held since the last call is kept
+// until it's older than tick, since a newer one couldn't show T-1 any more.
+// Never waits: when the sim is behind this is just the latest published.
+// Stays valid and unchanged until the next call.
+RenderSnapshot* acquireRenderSnapshot(SimThread* sim, long tick) {
+    RenderSnapshot* snapshot = &sim->snapshotSlots[tbReadIndex(&sim->snapshots)];
+    if ((long) snapshot->tick < tick && tbAcquire(&sim->snapshots)) {
+        snapshot = &sim->snapshotSlots[tbReadIndex(&sim->snapshots)];
+    }
+    return snapshot;
+}
+
+// Alpha to draw snapshot with for tick + alpha. Clamped, so a late snapshot
+// holds at its own tick instead of extrapolating, and drawing never goes back.
+float getSnapshotAlpha(RenderSnapshot* snapshot, long tick, float alpha) {
+    return Clamp(tick - (long) snapshot->tick + alpha, 0, 1);
+}
+
+
+////////////////////////////////////////////
+// ..Bench
+////////////////////////////////////////////
+
+// Headless benchmarks, each started by its own --bench-* flag from
+// BENCH_FLAGS. They print their timings and check every optimized path
+// against its reference with benchExpect; runBench prints the verdict and
+// turns it into the exit code.
+
+#define BENCH_FRAMES 100
+
+typedef struct Bench {
+    Rng rng;          // same seed on every run, so runs can be compared
+    bool isMatching;
+} Bench;
+
+// Record whether an optimized path matched its reference.
+void benchExpect(Bench* bench, bool isMatching) {
+    bench->isMatching = bench->isMatching && isMatching;
+}
+
+// Queue count boids the way boidsRender does every frame, with
+// geometryBatchAddCircles and with the scalar reference.
+void runGeometryBench(Bench* bench, size_t count) {
+    Rng* rng = &bench->rng;
+    Array boids = aCreate(count, sizeof(Boid));
+    boids.used = count;
+    for ITERATE(i, count) {
+        Boid* boid = aGet(&boids, i);
+        boid->entity.previousPosition = (Vector2){rngRange(rng, 0, 1000), rngRange(rng, 0, 1000)};
+        boid->entity.position = Vector2Add(boid->entity.previousPosition, (Vector2){rngRange(rng, -2, 2), rngRange(rng, -2, 2)});
+    }
+
+    Boid* first = boids.array;
+    GeometryCircles circles = {
+        &first->entity.position.x, &first->entity.previousPosition.x, sizeof(Boid),
+        count, 0.37, BOID_RADIUS, 0xFFE3DBC1
+    };
+
+    GeometryBatch batch, reference;
+    geometryBatchInit(&batch, count);
+    geometryBatchInit(&reference, count);
+
+    double startTime = getSeconds();
+    for ITERATE(frame, BENCH_FRAMES) {
+        geometryBatchClear(&batch);
+        geometryBatchAddCircles(&batch, &circles);
+    }
+    double batchSeconds = (getSeconds() - startTime) / BENCH_FRAMES;
+
+    startTime = getSeconds();
+    for ITERATE(frame, BENCH_FRAMES) {
+        geometryBatchClear(&reference);
+        geometryBatchAddCirclesScalar(&reference, &circles);
+    }
+    double referenceSeconds = (getSeconds() - startTime) / BENCH_FRAMES;
+
+    benchExpect(bench, batch.count == reference.count
+        && memcmp(batch.instances, reference.instances, batch.count * sizeof(GeometryInstance)) == 0);
+
+    printf("Geometry batch, %zu circles: %.3f ms per frame, %.3f ms scalar, %.1f MB uploaded per frame\n",
+        count, batchSeconds * 1000, referenceSeconds * 1000, batch.count * sizeof(GeometryInstance) / 1e6);
+
+    geometryBatchFree(&batch);
+    geometryBatchFree(&reference);
+    aFree(&boids);
+}
+
+
+// Step a surface of count water nodes with waterSpringStep and the scalar
+// reference, and its waves with phasors and with a sin per node and wave.
+// Step every node ticks times, returns the largest offset left.
+float runWaterSprings(WaterSolver solver, Array* offsets, Array* nextOffsets, Array* velocities, float delta, unsigned int ticks) {
+    size_t nodeCount = offsets->used;
+    float stiffness = WATER_SPRING_CONSTANT * delta;
+    float damping = pow(WATER_DAMPENING, delta);
+    for ITERATE(tick, ticks) {
+        if (solver == WATER_SOLVER_IMPLICIT) {
+            waterSpringSolveImplicit(offsets->array, nextOffsets->array, velocities->array, nodeCount, 0, nodeCount, stiffness, damping, delta);
+        } else {
+            waterSpringStep(offsets->array, nextOffsets->array, velocities->array, nodeCount, 0, nodeCount, stiffness, damping, delta);
+        }
+        Array swap = *offsets;
+        *offsets = *nextOffsets;
+        *nextOffsets = swap;
+    }
+
+    float maxOffset = 0;
+    for ITERATE(i, nodeCount) {
+        float offset = fabs(((float*) offsets->array)[i]);
+        if (!(offset <= maxOffset)) maxOffset = offset; // keeps NaN
+    }
+    return maxOffset;
+}
+
+void runWaterBench(Bench* bench, size_t count) {
+    Rng* rng = &bench->rng;
+    Array waves = aCreate(4, sizeof(WaterWave));
+    addWaterWaves(&waves);
+
+    WaterBody water;
+    Rectangle bounds = {0, WATER_LINE, SCREEN_SIZE.x, SCREEN_SIZE.y - WATER_LINE};
+    initWaterBody(&water, bounds, count / bounds.width, WATER_SOLVER_EXPLICIT);
+    size_t nodeCount = getWaterNodeCount(&water);
+    for ITERATE(i, nodeCount) {
+        ((float*) water.velocities.array)[i] = rngRange(rng, -100, 100);
+    }
+
+    Array offsets = aCreate(nodeCount, sizeof(float));
+    Array nextOffsets = aCreate(nodeCount, sizeof(float));
+    Array velocities = aCreate(nodeCount, sizeof(float));
+    aCopy(&offsets, &water.offsets);
+    aCopy(&velocities, &water.velocities);
+    nextOffsets.used = nodeCount;
+
+    // Every node at once, the cost of a surface that never sleeps.
+    float delta = FIXED_DELTA; // same rounding as waterBodyUpdate
+    float stiffness = WATER_SPRING_CONSTANT * delta;
+    float damping = pow(WATER_DAMPENING, delta);
+    double startTime = getSeconds();
+    for ITERATE(frame, BENCH_FRAMES) {
+        waterSpringStep(water.offsets.array, water.nextOffsets.array, water.velocities.array, nodeCount, 0, nodeCount, stiffness, damping, delta);
+        Array swap = water.offsets;
+        water.offsets = water.nextOffsets;
+        water.nextOffsets = swap;
+    }
+    double springSeconds = (getSeconds() - startTime) / BENCH_FRAMES;
+
+    startTime = getSeconds();
+    for ITERATE(frame, BENCH_FRAMES) {
+        waterSpringStepScalar(offsets.array, nextOffsets.array, velocities.array, nodeCount, 0, nodeCount, stiffness, damping, delta);
+        Array swap = offsets;
+        offsets = nextOffsets;
+        nextOffsets = swap;
+    }
+    double springReferenceSeconds = (getSeconds() - startTime) / BENCH_FRAMES;
+
+    benchExpect(bench, memcmp(offsets.array, water.offsets.array, nodeCount * sizeof(float)) == 0
+        && memcmp(velocities.array, water.velocities.array, nodeCount * sizeof(float)) == 0);
+
+    updateWavePhasors(&water, &waves);
+    startTime = getSeconds();
+    for ITERATE(frame, BENCH_FRAMES) {
+        updateWaterWaves(&water, &waves, frame * (FIXED_DELTA));
+    }
+    double waveSeconds = (getSeconds() - startTime) / BENCH_FRAMES;
+
+    float* naturalOffsets = offsets.array;
+    startTime = getSeconds();
+    for ITERATE(frame, BENCH_FRAMES) {
+        float time = frame * (FIXED_DELTA);
+        for ITERATE(i, nodeCount) {
+            naturalOffsets[i] = 0;
+            for ITERATE(j, waves.used) {
+                WaterWave* wave = aGet(&waves, j);
+                naturalOffsets[i] += wave->magnitude * sin(-wave->speed * time + 2 * PI * (getWaterNodeX(&water, i) / wave->period - wave->offset));
+            }
+        }
+    }
+    double waveReferenceSeconds = (getSeconds() - startTime) / BENCH_FRAMES;
+
+    float maxWaveDifference = 0;
+    for ITERATE(i, nodeCount) {
+        maxWaveDifference = fmax(maxWaveDifference, fabs(naturalOffsets[i] - ((float*) water.naturalOffsets.array)[i]));
+    }
+    benchExpect(bench, maxWaveDifference < 1e-3);
+
+    // One splash on a surface at rest, followed until it settles or the
+    // frames run out.
+    cleanWaterBody(&water);
+    initWaterBody(&water, bounds, count / bounds.width, WATER_SOLVER_EXPLICIT);
+    splashWater(&water, (Vector2){bounds.x + bounds.width / 2, bounds.y}, -200);
+    WaterStats previousStats = waterStats;
+    startTime = getSeconds();
+    for ITERATE(frame, BENCH_FRAMES * 10) {
+        waterBodyUpdate(&water, FIXED_DELTA);
+    }
+    double splashSeconds = (getSeconds() - startTime) / (BENCH_FRAMES * 10);
+    double awakeSegments = (double) (waterStats.awakeSegments - previousStats.awakeSegments) / (waterStats.steps - previousStats.steps);
+
+    // One implicit step checked against the system it solves, with A the
+    // negated pull: x' + c A x' = x + delta damping v.
+    float* x = offsets.array;
+    float* v = velocities.array;
+    float* solved = nextOffsets.array;
+    for ITERATE(i, nodeCount) {
+        x[i] = rngRange(rng, -10, 10);
+        v[i] = rngRange(rng, -100, 100);
+    }
+    Array startVelocities = aCreate(nodeCount, sizeof(float));
+    aCopy(&startVelocities, &velocities);
+    float coupling = damping * stiffness * delta;
+    waterSpringSolveImplicit(x, solved, v, nodeCount, 0, nodeCount, stiffness, damping, delta);
+
+    float maxResidual = 0;
+    for ITERATE(i, nodeCount) {
+        float pull = -solved[i];
+        if (i > 0) pull += solved[i - 1] - solved[i];
+        if (i + 1 < nodeCount) pull += solved[i + 1] - solved[i];
+        float expected = x[i] + delta * damping * ((float*) startVelocities.array)[i];
+        maxResidual = fmax(maxResidual, fabs(solved[i] - coupling * pull - expected));
+    }
+    benchExpect(bench, maxResidual < 1e-3);
+
+    startTime = getSeconds();
+    runWaterSprings(WATER_SOLVER_IMPLICIT, &offsets, &nextOffsets, &velocities, FIXED_DELTA, BENCH_FRAMES);
+    double implicitSeconds = (getSeconds() - startTime) / BENCH_FRAMES;
+
+    // Both solvers from the same random velocities at 4 ticks per second.
+    float slowDelta = 0.25;
+    float maxOffsets[2];
+    WaterSolver solvers[] = {WATER_SOLVER_EXPLICIT, WATER_SOLVER_IMPLICIT};
+    for ITERATE(i, 2) {
+        memset(offsets.array, 0, nodeCount * sizeof(float));
+        aCopy(&velocities, &startVelocities);
+        maxOffsets[i] = runWaterSprings(solvers[i], &offsets, &nextOffsets, &velocities, slowDelta, 40);
+    }
+    benchExpect(bench, maxOffsets[1] < 100);
+
+    printf("Water, %zu nodes: springs %.3f ms per tick, %.3f ms scalar. Waves %.3f ms per tick, %.3f ms with sin, %.2g apart.\n",
+        nodeCount, springSeconds * 1000, springReferenceSeconds * 1000, waveSeconds * 1000, waveReferenceSeconds * 1000,
+        maxWaveDifference);
+    printf("One splash: %.3f ms per tick, %.1f of %zu segments awake.\n",
+        splashSeconds * 1000, awakeSegments, getWaterSegmentCount(nodeCount));
+    printf("Implicit springs: %.3f ms per tick, solved to %.2g. After 10s at 4 ticks per second, largest offset %.3g explicit, %.3g implicit.\n",
+        implicitSeconds * 1000, maxResidual, maxOffsets[0], maxOffsets[1]);
+
+    cleanWaterBody(&water);
+    aFree(&offsets);
+    aFree(&nextOffsets);
+    aFree(&velocities);
+    aFree(&startVelocities);
+    aFree(&waves);
+}
+
+// count particles in a pool of that capacity, all under water with random
+// ages so some of them die on every tick.
+void runParticleBench(Bench* bench, size_t count) {
+    Rng* rng = &bench->rng;
+    ParticleMotion motion = {-GRAVITY * 0.2, BLOOD_PARTICLE_DAMPENING, 10, PARTICLE_DIES_OUT_OF_WATER, 0, 0, 10000, 10000};
+
+    ParticlePool pool, referencePool;
+    particlePoolInit(&pool, count);
+    particlePoolInit(&referencePool, count);
+    double startTime = getSeconds();
+    for ITERATE(i, count) {
+        particlePoolSpawn(&pool, rngRange(rng, 1000, 9000), rngRange(rng, 1000, 9000), rngRange(rng, -50, 50), rngRange(rng, -50, 50), 4);
+    }
+    double spawnSeconds = getSeconds() - startTime;
+
+    for ITERATE(i, count) {
+        pool.fields[PARTICLE_LIFETIME][i] = rngRange(rng, 0, motion.maxLifetime);
+    }
+    Array particles = aCreate(count, sizeof(Particle));
+    particlePoolCopyOut(&pool, particles.array);
+    particlePoolCopyIn(&referencePool, particles.array, count);
+
+    startTime = getSeconds();
+    for ITERATE(frame, BENCH_FRAMES) {
+        particlePoolStep(&pool, &motion, FIXED_DELTA);
+    }
+    double stepSeconds = (getSeconds() - startTime) / BENCH_FRAMES;
+
+    startTime = getSeconds();
+    for ITERATE(frame, BENCH_FRAMES) {
+        particlePoolStepScalar(&referencePool, &motion, FIXED_DELTA);
+    }
+    double referenceSeconds = (getSeconds() - startTime) / BENCH_FRAMES;
+
+    benchExpect(bench, pool.count == referencePool.count
+        && memcmp(pool.flags, referencePool.flags, pool.count * sizeof(uint32_t)) == 0);
+    for ITERATE(field, PARTICLE_FIELD_COUNT) {
+        benchExpect(bench, pool.count == referencePool.count
+            && memcmp(pool.fields[field], referencePool.fields[field], pool.count * sizeof(float)) == 0);
+    }
+
+    printf("Particles, %zu: %.3f ms per tick, %.3f ms scalar, %zu retired. Spawning all %.3f ms.\n",
+        count, stepSeconds * 1000, referenceSeconds * 1000, count - pool.count, spawnSeconds * 1000);
+
+    aFree(&particles);
+    particlePoolFree(&pool);
+    particlePoolFree(&referencePool);
+}
+
+#define HASH_TABLE_BENCH_WINDOWS 8
+#define HASH_TABLE_BENCH_CYCLES 500000 // insert/remove cycles per window
+#define HASH_TABLE_BENCH_LOOKUPS 100000 // hits and misses each, per window
+
+// "e" and 8 hex digits, like an entity name, without sprintf's cost.
+void formatBenchKey(char* key, uint32_t id) {
+    static const char digits[] = "0123456789abcdef";
+    key[0] = 'e';
+    for ITERATE(i, 8) {
+        key[1 + i] = digits[(id >> (28 - 4 * i)) & 15];
+    }
+    key[9] = 0;
+}
+
+// count live keys under constant churn: every cycle removes a random key and
+// inserts a new one. Lookup times should not drift as the cycles add up.
+void runHashTableBench(Bench* bench, size_t count) {
+    Rng* rng = &bench->rng;
+    HashTable* table = htCreate();
+    htReserve(table, count);
+    Array liveIds = aCreate(count, sizeof(uint32_t));
+    uint32_t nextId = 0;
+    char key[16];
+    for ITERATE(i, count) {
+        formatBenchKey(key, nextId);
+        htSet(table, key, (void*) (uintptr_t) (nextId + 1));
+        aAppend(&liveIds, &nextId);
+        nextId++;
+    }
+
+    double minHitSeconds = INFINITY, maxHitSeconds = 0;
+    printf("Hash table, %zu keys, %d insert/remove cycles between lookups:\n", count, HASH_TABLE_BENCH_CYCLES);
+    for ITERATE(window, HASH_TABLE_BENCH_WINDOWS) {
+        double startTime = getSeconds();
+        for ITERATE(cycle, HASH_TABLE_BENCH_CYCLES) {
+            uint32_t* id = aGet(&liveIds, rngNext(rng) % liveIds.used);
+            formatBenchKey(key, *id);
+            benchExpect(bench, htRemove(table, key) == (void*) (uintptr_t) (*id + 1));
+            *id = nextId++;
+            formatBenchKey(key, *id);
+            htSet(table, key, (void*) (uintptr_t) (*id + 1));
+        }
+        double cycleSeconds = (getSeconds() - startTime) / HASH_TABLE_BENCH_CYCLES;
+
+        startTime = getSeconds();
+        for ITERATE(i, HASH_TABLE_BENCH_LOOKUPS) {
+            uint32_t id = *(uint32_t*) aGet(&liveIds, rngNext(rng) % liveIds.used);
+            formatBenchKey(key, id);
+            benchExpect(bench, htGet(table, key) == (void*) (uintptr_t) (id + 1));
+        }
+        double hitSeconds = (getSeconds() - startTime) / HASH_TABLE_BENCH_LOOKUPS;
+
+        // Ids from the top half were never inserted.
+        startTime = getSeconds();
+        for ITERATE(i, HASH_TABLE_BENCH_LOOKUPS) {
+            formatBenchKey(key, rngNext(rng) | 0x80000000);
+            benchExpect(bench, htGet(table, key) == NULL);
+        }
+        double missSeconds = (getSeconds() - startTime) / HASH_TABLE_BENCH_LOOKUPS;
+
+        minHitSeconds = fmin(minHitSeconds, hitSeconds);
+        maxHitSeconds = fmax(maxHitSeconds, hitSeconds);
+        printf("    after %4.1fM cycles: %.0f ns per cycle, %.0f ns per hit, %.0f ns per miss\n",
+            (window + 1) * HASH_TABLE_BENCH_CYCLES / 1e6, cycleSeconds * 1e9, hitSeconds * 1e9, missSeconds * 1e9);
+    }
+    benchExpect(bench, htLength(table) == count);
+
+    htSetShrinking(table, true);
+    double startTime = getSeconds();
+    for ITERATE(i, liveIds.used) {
+        formatBenchKey(key, *(uint32_t*) aGet(&liveIds, i));
+        htRemove(table, key);
+    }
+    double clearSeconds = getSeconds() - startTime;
+    benchExpect(bench, htLength(table) == 0);
+
+    printf("Slowest hits %.2fx the fastest. Removing all keys %.3f ms.\n",
+        maxHitSeconds / minHitSeconds, clearSeconds * 1000);
+
+    htDestroy(table);
+    aFree(&liveIds);
+}
+
+typedef struct BenchFlag {
+    const char* flag;
+    void (*run)(Bench* bench, size_t count);
+    const char* results; // what run compares with its reference, for the verdict
+} BenchFlag;
+
+const BenchFlag BENCH_FLAGS[] = {
+    {"--bench-geometry",   runGeometryBench,  "instances"},
+    {"--bench-water",      runWaterBench,     "surfaces"},
+    {"--bench-particles",  runParticleBench,  "particles"},
+    {"--bench-hash-table", runHashTableBench, "contents"},
+};
+
+const BenchFlag* findBenchFlag(const char* flag) {
+    for ITERATE(i, sizeof(BENCH_FLAGS) / sizeof(BENCH_FLAGS[0])) {
+        if (strcmp(flag, BENCH_FLAGS[i].flag) == 0) return &BENCH_FLAGS[i];
+    }
+    return NULL;
+}
+
+// Run one benchmark from a fixed seed and return the exit code: non-zero
+// when an optimized path doesn't match its reference.
+int runBench(const BenchFlag* benchFlag, size_t count) {
+    Bench bench = {rngCreate(1, 0), true};
+    benchFlag->run(&bench, count);
+    printf(bench.isMatching ? "Same %s as the reference\n" : "%s DIFFER from the reference\n", benchFlag->results);
+    return bench.isMatching ? 0 : 1;
+}
+
+
+////////////////////////////////////////////
+// ..Main
+////////////////////////////////////////////
+
+//------------------------------------------------------------------------------------
+// Program main entry point
+//------------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    // Initialization
+    //--------------------------------------------------------------------------------------
+    const char* recordPath = NULL;
+    const char* replayPath = NULL;
+    const char* loadSnapshotPath = NULL;
+    const char* saveSnapshotPath = NULL;
+    const char* packPath = NULL;
+    const char* exportFramesPath = NULL;
+    const BenchFlag* benchFlag = NULL;
+    size_t benchCount = 0;
+    bool syncAudio = false;
+    bool softwareRender = false;
+    uint64_t seed = (uint64_t) time(NULL);
+    unsigned int threadCount = jobsHardwareThreadCount();
+    unsigned int renderThreadCount = 0; // half of threadCount unless set
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sync-audio") == 0)   syncAudio = true;
+        else if (strcmp(argv[i], "--software-render") == 0)  softwareRender = true;
+        else if (strcmp(argv[i], "--implicit-water") == 0)   waterSettings.solver = WATER_SOLVER_IMPLICIT;
+    }
+
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0)   recordPath = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0)   replayPath = argv[++i];
+        else if (strcmp(argv[i], "--seed") == 0)     seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--load-snapshot") == 0)    loadSnapshotPath = argv[++i];
+        else if (strcmp(argv[i], "--save-snapshot") == 0)    saveSnapshotPath = argv[++i];
+        else if (strcmp(argv[i], "--pack") == 0)     packPath = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0)  threadCount = fmax(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--render-threads") == 0)   renderThreadCount = fmax(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--export-frames") == 0)    exportFramesPath = argv[++i];
+        else if (strcmp(argv[i], "--water-density") == 0)    waterSettings.nodesPerDistance = fmax(0.01, atof(argv[++i]));
+        else if (findBenchFlag(argv[i])) {
+            benchFlag = findBenchFlag(argv[i]);
+            benchCount = fmax(1, strtoull(argv[++i], NULL, 10));
+        }
+    }
+
+    jobSystemInit(&jobSystem, threadCount);
+    jobSystemInit(&renderJobSystem, renderThreadCount ? renderThreadCount : fmax(1, threadCount / 2));
+
+    if (packPath) {
+        bool isPacked = writeAssetPack(packPath);
+        if (!isPacked) printf("Could not write asset pack %s\n", packPath);
+        jobSystemClean(&jobSystem);
+        jobSystemClean(&renderJobSystem);
+        return isPacked ? 0 : 1;
+    }
+
+    if (benchFlag) {
+        int result = runBench(benchFlag, benchCount);
+        jobSystemClean(&jobSystem);
+        jobSystemClean(&renderJobSystem);
+        return result;
+    }
+
+    if (replayPath) {
+        int result = runReplay(replayPath, loadSnapshotPath, saveSnapshotPath, exportFramesPath);
+        jobSystemClean(&jobSystem);
+        jobSystemClean(&renderJobSystem);
+        return result;
+    }
+
+    Vector2 screenSize = SCREEN_SIZE;
 
     
-    COLOR_HIGHLIGHT = GetColor(0xBC4B51FF);
+    World currentWorld;
+    if (!startWorld(&currentWorld, seed, loadSnapshotPath)) {
+        return 1;
+    }
+
+    InputRecorder recorder = {0};
+    if (recordPath && !startRecording(&recorder, recordPath, currentWorld.seed)) {
+        printf("Could not open %s for recording\n", recordPath);
+    }
 
+    SetConfigFlags(FLAG_VSYNC_HINT);
     InitWindow(screenSize.x, screenSize.y, "raylib [core] example - basic window");
     InitAudioDevice();
 
-    loadSprites();
-    loadSounds();
-    loadFonts();
-    loadShaders();
+    loadAssets(true, softwareRender);
+    initGeometryRenderer();
+    maskShaderLocations = (MaskShaderLocations){
+        GetShaderLocation(MASK_SHADER, "cutoff"),
+        GetShaderLocation(MASK_SHADER, "col1"),
+        GetShaderLocation(MASK_SHADER, "col2"),
+    };
+    if (syncAudio) uploadSounds();
+    else startAudioThread(&audioThread);
 
     SetWindowTitle("NOM");
     SetWindowIcon(FISH_WINDOW_ICON);
@@ -1349,15 +4949,30 @@ int main(void) {
     camera.offset = Vector2Zero();
     camera.rotation = 0.0f;
     camera.zoom = 1.0f;
-    shakeStrength = 0.0f;
 
     cameraCenter = Vector2Scale(screenSize, 0.5);
 
-    Vector2 comboTextureSize = (Vector2){screenSize.x, 300};
+    Vector2 comboTextureSize = COMBO_TEXTURE_SIZE;
     RenderTexture2D comboTexture = LoadRenderTexture(comboTextureSize.x, comboTextureSize.y);
+    FrameRender frameRender;
+    initFrameRender(&frameRender, comboTexture);
+
+    // --software-render: frames are rasterized on the CPU and shown as one texture.
+    SoftwareRenderer softwareRenderer = {0};
+    Texture2D softwareTexture = {0};
+    if (softwareRender) {
+        initSoftwareRenderer(&softwareRenderer, screenSize, comboTextureSize, &renderJobSystem);
+        softwareTexture = LoadTextureFromImage(getSoftwareImage(&softwareRenderer.targets[RENDER_TARGET_SCREEN]));
+    }
     
 
-    SetTargetFPS(60);               // Set our game to run at 60 frames-per-second
+    // No frame cap: frames follow the display, ticks follow FIXED_DELTA.
+    float tickAccumulator = 0.0;
+    unsigned long requestedTicks = 0;
+    unsigned long droppedTicks = 0;
+
+    SimThread sim;
+    startSimThread(&sim, &currentWorld, &recorder);
     //--------------------------------------------------------------------------------------
 
     // Main game loop
@@ -1371,145 +4986,98 @@ int main(void) {
         //     shakeStrength = 100.0f;
         // }
 
-        COLOR_BG = (currentWorld.snake.comboLevel >= 10) ? COLOR_LIGHT : COLOR_DARK;
-        COLOR_MAIN = (currentWorld.snake.comboLevel >= 10) ? COLOR_DARK : COLOR_LIGHT;
-
-        shakeStrength = Lerp(shakeStrength, 0.0, FIXED_DELTA * 5);
-        shakeOffset = (Vector2){ RandRange(-shakeStrength, shakeStrength), RandRange(-shakeStrength, shakeStrength)};
-        
-        camera.target = (Vector2){RandRange(-shakeStrength, shakeStrength), RandRange(-shakeStrength, shakeStrength)};
-
-        comboFlashPercentage = Lerp(comboFlashPercentage, 0.0, FIXED_DELTA * 5);
-        //printf("%f\n", camera.target.x);
-
         // if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
         //     boidExplosiveSpawn(&currentWorld, GetMousePosition(), 400);
         // }
-        
-        if (gameHasStarted) {
-            currentWorld.boidBombSpawnTime -= FIXED_DELTA;
-            if (currentWorld.boidBombSpawnTime <= 0.0) {
-                currentWorld.boidBombSpawnTime = RandRange(5.0, 8.0);
-
-                if (currentWorld.boids.used < 2000) {
-                    bool spawnOnLeft = RandBool();
-                    spawnBoidBomb(
-                        &currentWorld, 
-                        (Vector2) {spawnOnLeft ? -40 : currentWorld.bounds.width + 40, Lerp(40, WATER_LINE - 40, RandFloat())}, 
-                        (Vector2) {(spawnOnLeft ? 1 : -1) * Lerp(40, 60, RandFloat()), 0},
-                        fixedTime,
-                        Lerp(200, 800, RandFloat())
-                    );
-                }
-            }
-        }
 
-        clearDeadEntities(&currentWorld.boids);
-        clearDeadEntities(&currentWorld.boidBombs);
-        clearDeadEntities(&currentWorld.splashParticles);
-        clearDeadEntities(&currentWorld.bloodParticles);
-
-        clearBoidMap(&currentWorld.boidMap);
-        populateBoidMap(&currentWorld.boidMap, &currentWorld.boids);
-        boidsReact(&currentWorld.boids, &currentWorld.boidMap, &currentWorld.water, currentWorld.water.bounds, currentWorld.snake.entity.position, FIXED_DELTA);
-        boidsMove(&currentWorld.boids, &currentWorld.water, currentWorld.bounds, currentWorld.water.bounds, FIXED_DELTA);
-       
-
-
-        boidBombsMove(&currentWorld.boidBombs, currentWorld.bounds, FIXED_DELTA);
-        
+        // Run as many fixed ticks as the elapsed time covers, dropping time
+        // the sim can't catch up on rather than falling further behind.
+        tickAccumulator += GetFrameTime();
+        unsigned int tickCount = floor(tickAccumulator / (FIXED_DELTA));
+        tickAccumulator -= tickCount * (FIXED_DELTA);
+        if (tickCount > MAX_TICKS_PER_FRAME) {
+            droppedTicks += tickCount - MAX_TICKS_PER_FRAME;
+            tickCount = MAX_TICKS_PER_FRAME;
+        }
 
-        snakeUpdate(&currentWorld.snake, &currentWorld.water, FIXED_DELTA);
-        snakeMove(&currentWorld.snake, currentWorld.bounds, &currentWorld.splashParticles, &currentWorld.water, fixedTime, FIXED_DELTA);
-        snakeEat(&currentWorld.snake, &currentWorld, &currentWorld.boids, &currentWorld.boidBombs, &currentWorld.bloodParticles, fixedTime, FIXED_DELTA);
+        // Draw one tick behind the accumulator. The snapshot is taken before
+        // this frame's ticks are requested, and the sim runs them while it draws.
+        requestedTicks += tickCount;
+        long drawnTick = (long) requestedTicks - 1;
+        RenderSnapshot* frame = acquireRenderSnapshot(&sim, drawnTick);
+        requestSimTicks(&sim, pollInput(), tickCount);
+        float alpha = getSnapshotAlpha(frame, drawnTick, tickAccumulator / (FIXED_DELTA));
+        float renderTime = frame->time - (1.0 - alpha) * (FIXED_DELTA);
 
-        waterBodyUpdate(&currentWorld.water, FIXED_DELTA);
-        waterBodyMove(&currentWorld.water, &waves, fixedTime, FIXED_DELTA);
+        setPalette(frame->snake.comboLevel);
 
-        splashParticlesMove(&currentWorld.splashParticles, &currentWorld.water, FIXED_DELTA);
-        bloodParticlesMove(&currentWorld.bloodParticles, &currentWorld.water, FIXED_DELTA);
+        camera.target = frame->shakeOffset;
+        //printf("%f\n", camera.target.x);
         
         // Draw
         //----------------------------------------------------------------------------------
+        recordFrame(&frameRender, frame, getCameraView(camera, screenSize), alpha, renderTime);
+        if (softwareRender) {
+            softwareExecuteRenderQueue(&softwareRenderer, &frameRender.queue, camera, COLOR_BG);
+            UpdateTexture(softwareTexture, softwareRenderer.targets[RENDER_TARGET_SCREEN].pixels);
+        }
+
         BeginDrawing(); {
             
             ClearBackground(COLOR_BG);
+            if (softwareRender) {
+                countDraw(softwareTexture);
+                DrawTexture(softwareTexture, 0, 0, WHITE);
+            } else {
+                executeRenderQueue(&frameRender.queue, comboTexture, camera);
+            }
 
-            
-
-            BeginMode2D(camera); 
-                char str[80];
-
-                if (gameHasStarted) {
-                    int comboBonus = (int) getComboBonus(currentWorld.snake.comboLevel);
-                    sprintf(str, "x%d", (int) getComboBonus(currentWorld.snake.comboLevel));
-                    Vector2 drawPosition = RectangleCenter(currentWorld.water.bounds);
-                    drawPosition.y += 60;
-
-                    float cutoff = currentWorld.snake.comboLevel - floor(currentWorld.snake.comboLevel);
-                    float colorBonus = currentWorld.snake.comboHealth;
-                    EndMode2D();
-                    BeginTextureMode(comboTexture); {
-                        Vector2 scale = getSquashScale((1.0 - comboFlashPercentage) * 0.5, 1.05);
-
-                        ClearBackground((Color){0});
-                        Vector2 textSize = DrawTextAnchored( Vector2Scale(comboTextureSize, 0.5), (Vector2){0.5, 0.5}, MAIN_FONT, str, 200 * scale.x, 0.0, WHITE);
-                        float half = (1.0 - (textSize.y / comboTextureSize.y)) / 2.0;
-                        cutoff = Remap(cutoff, 0.0, 1.0, half + 0.1, 1.0 - half - 0.15);
-                    } EndTextureMode();
-                    BeginMode2D(camera); 
-                    
-                    BeginShaderMode(MASK_SHADER); {
-                        //DrawTexture(comboTexture.texture, 50, 50, WHITE);
-                        
-                        
-
-                        SetShaderValue(MASK_SHADER, GetShaderLocation(MASK_SHADER, "cutoff"), &cutoff, SHADER_UNIFORM_FLOAT);
-                        
-
-                        GLSLColor color2 = glslColor(ColorLerp(ColorLerp(COLOR_BG, COLOR_MAIN, 0.1 + colorBonus * 0.1), COLOR_MAIN, comboFlashPercentage));
-                        GLSLColor color1 = glslColor(ColorLerp(ColorLerp(COLOR_BG, COLOR_MAIN, 0.2 + colorBonus * 0.1), COLOR_MAIN, comboFlashPercentage));
-
-    
-
-                        color1.a = Lerp(0.1, 1.0, currentWorld.snake.comboHealth);
-                        color2.a = color1.a;
-                        SetShaderValue(MASK_SHADER, GetShaderLocation(MASK_SHADER, "col1"), &color1, SHADER_UNIFORM_VEC4);
-                        SetShaderValue(MASK_SHADER, GetShaderLocation(MASK_SHADER, "col2"), &color2, SHADER_UNIFORM_VEC4);
-
-                        
-
-                        DrawTextureRec(comboTexture.texture, (Rectangle){ 0, 0, comboTexture.texture.width, -comboTexture.texture.height}, Vector2Add(Vector2Subtract(drawPosition, Vector2Multiply(comboTextureSize, (Vector2){0.5, 1.0})), ((Vector2){0, 40})), WHITE);
-                        // DrawTexturePro(comboTexture.texture, (Rectangle){ 0, 0, comboTexture.texture.width, -comboTexture.texture.height}, 
-                        // (Rectangle){ drawPosition.x - comboTexture.texture.width / 2, drawPosition.y - comboTexture.texture.height / 2, comboTexture.texture.width, -comboTexture.texture.height}, 
-                        // Vector2Zero(), 0, WHITE);
-                    } EndShaderMode();
-
-                    sprintf(str, "%d", (int) floor(currentWorld.snake.score));
-                    DrawTextAnchored(drawPosition, (Vector2){0.5, 0.0}, MAIN_FONT, str, 50, 0.0, ColorLerp(COLOR_BG, COLOR_MAIN, 0.1));
-                } else {
-                    Vector2 drawPosition = RectangleCenter(currentWorld.water.bounds);
-                    DrawTextAnchored(drawPosition, (Vector2){0.5, 1.0}, MAIN_FONT, "[WASD] to Move.", 50, 0.0, ColorLerp(COLOR_BG, COLOR_MAIN, 0.3));
-                    DrawTextAnchored(drawPosition, (Vector2){0.5, 0.0}, MAIN_FONT, "[Space] to Dash.", 50, 0.0, ColorLerp(COLOR_BG, COLOR_MAIN, 0.3));
-                }
-                
-
-                bloodParticlesRender(&currentWorld.bloodParticles);
-                boidsRender(&currentWorld.boids);
-                waterBodyRender(&currentWorld.water);
-                boidBombsRender(&currentWorld.boidBombs, fixedTime);
-                snakeRender(&currentWorld.snake, fixedTime);
-                splashParticlesRender(&currentWorld.splashParticles);
-                
-            EndMode2D();
-        } EndDrawing();
+        } EndDrawing(); countBatchFlush();
+        finishDrawStatsFrame();
         //----------------------------------------------------------------------------------
-
-        fixedTime += FIXED_DELTA;
     }
 
     // De-Initialization
     //--------------------------------------------------------------------------------------
+    stopSimThread(&sim);
+    stopAudioThread(&audioThread);
+    jobSystemClean(&jobSystem);
+    jobSystemClean(&renderJobSystem);
+    cleanFrameRender(&frameRender);
+    if (DEBUG_ENABLED) {
+        printf("Ticks: %lu simulated, %lu dropped to slow down\n", sim.tick, droppedTicks);
+        printf("Sound hand-over on the simulation thread (%s): %.3f us per tick, %lu commands dropped\n",
+            syncAudio ? "synchronous" : "audio thread",
+            soundVoiceStats.flushes ? soundVoiceStats.flushSeconds / soundVoiceStats.flushes * 1e6 : 0.0,
+            soundVoiceStats.commandsDropped);
+        printf("Sounds: %lu requested, %lu merged into playing voices, %lu voices started, %lu stolen, %lu dropped\n",
+            soundVoiceStats.requested, soundVoiceStats.merged, soundVoiceStats.played, soundVoiceStats.stolen, soundVoiceStats.dropped);
+        if (drawStats.frames) {
+            printf("Combo text drawn into its texture on %lu of %lu frames\n", hudTexts.comboRenders, drawStats.frames);
+            const char* culledNames[] = {"boids", "splash particles", "blood particles"};
+            RenderSystem culledSystems[] = {RENDER_SYSTEM_BOIDS, RENDER_SYSTEM_SPLASH_PARTICLES, RENDER_SYSTEM_BLOOD_PARTICLES};
+            for ITERATE(i, 3) {
+                CullStats* stats = &frameRender.cullStats[culledSystems[i]];
+                printf("Culling %s: %.1f drawn, %.1f culled per frame\n", culledNames[i],
+                    (double) stats->drawn / drawStats.frames, (double) stats->culled / drawStats.frames);
+            }
+            printf("Draw calls per frame: %.1f average, %u max. Batch flushes per frame: %.1f average, %u max\n",
+                (double) drawStats.totalDrawCalls / drawStats.frames, drawStats.maxDrawCalls,
+                (double) drawStats.totalBatchFlushes / drawStats.frames, drawStats.maxBatchFlushes);
+        }
+        printSoftwareRenderStats(&softwareRenderer);
+        printWaterStats();
+        printParticleStats();
+    }
+    if (softwareRender) {
+        cleanSoftwareRenderer(&softwareRenderer);
+        UnloadTexture(softwareTexture);
+    }
+    stopRecording(&recorder);
+    if (saveSnapshotPath && !saveWorldSnapshot(&currentWorld, saveSnapshotPath)) {
+        printf("Could not save snapshot %s\n", saveSnapshotPath);
+    }
+    cleanGeometryRenderer();
     CloseWindow();        // Close window and OpenGL context
     //--------------------------------------------------------------------------------------
 